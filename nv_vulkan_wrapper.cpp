@@ -8,6 +8,8 @@
 #include <iostream>
 #include <functional>
 
+#include "primus_vk_names.h"
+
 extern "C" VKAPI_ATTR VkResult VKAPI_CALL vk_icdNegotiateLoaderICDInterfaceVersion(uint32_t* pSupportedVersion);
 
 
@@ -235,7 +237,7 @@ VKAPI_ATTR auto VKAPI_CALL forward(Args... args) -> decltype((init.internal().*p
 }
 
 template<auto p, typename PFN = typename std::remove_reference<decltype(init.internal().*p)>::type>
-auto forwarder() -> PFN {
+constexpr auto forwarder() -> PFN {
   return &forward<PFN, p>;
 }
 PFN_vkVoidFunction vk_GetDeviceProcAddr(
@@ -258,30 +260,28 @@ extern "C" VKAPI_ATTR PFN_vkVoidFunction VKAPI_CALL vk_icdGetInstanceProcAddr(
   return init.icd->vk_icdGetInstanceProcAddr(instance, pName);
 }
 
+// functions of the internal icd we override
+constexpr auto override_entry_points = [](auto &&visit){
+  visit("vkGetInstanceProcAddr", &vk_icdGetInstanceProcAddr);
+  visit("vkGetDeviceProcAddr", &vk_GetDeviceProcAddr);
+  visit("vkCreateInstance", forwarder<&InternalVulkanIcd::createInstance>());
+  visit("vkDestroyInstance", forwarder<&InternalVulkanIcd::destroyInstance>());
+  visit("vkCreateDevice", forwarder<&InternalVulkanIcd::createDevice>());
+  visit("vkDestroyDevice", forwarder<&InternalVulkanIcd::destroyDevice>());
+  visit("vkGetDeviceQueue", forwarder<&InternalVulkanIcd::getDeviceQueue>());
+  visit("vkCreateSwapchainKHR", forwarder<&InternalVulkanIcd::createSwapchainKHR>());
+  visit("vkDestroySwapchainKHR", forwarder<&InternalVulkanIcd::destroySwapchainKHR>());
+  visit("vkQueuePresentKHR", forwarder<&InternalVulkanIcd::queuePresentKHR>());
+  visit("vkQueueSubmit", forwarder<&InternalVulkanIcd::queueSubmit>());
+};
+constexpr size_t OVERRIDE_COUNT = countEntries(override_entry_points);
+constexpr NameTable<OVERRIDE_COUNT> override_names(override_entry_points);
+const auto override_functions = entryFunctions<PFN_vkVoidFunction, OVERRIDE_COUNT>(override_entry_points);
+
 PFN_vkVoidFunction getOverrideFn(const char *pName){
-  std::string name = pName;
-  if(name == "vkGetInstanceProcAddr") {
-    return (PFN_vkVoidFunction) vk_icdGetInstanceProcAddr;
-  }else if(name == "vkGetDeviceProcAddr") {
-    return (PFN_vkVoidFunction) vk_GetDeviceProcAddr;
-  }else if(name == "vkCreateInstance") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::createInstance>();
-  }else if(name == "vkDestroyInstance") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::destroyInstance>();
-  }else if(name == "vkCreateDevice") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::createDevice>();
-  }else if(name == "vkDestroyDevice") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::destroyDevice>();
-  }else if(name == "vkGetDeviceQueue") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::getDeviceQueue>();
-  }else if(name == "vkCreateSwapchainKHR") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::createSwapchainKHR>();
-  }else if(name == "vkDestroySwapchainKHR") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::destroySwapchainKHR>();
-  }else if(name == "vkQueuePresentKHR") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::queuePresentKHR>();
-  }else if(name == "vkQueueSubmit") {
-    return (PFN_vkVoidFunction) forwarder<&InternalVulkanIcd::queueSubmit>();
+  const int index = override_names.find(pName);
+  if(index >= 0){
+    return override_functions[index];
   }
   return nullptr;
 }
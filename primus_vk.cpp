@@ -7,6 +7,7 @@
 #include "vk_layer_dispatch_table.h"
 
 #include <cassert>
+#include <cmath>
 #include <cstring>
 
 #include <mutex>
@@ -14,6 +15,7 @@
 #include <map>
 #include <vector>
 #include <list>
+#include <array>
 #include <iostream>
 
 #include <pthread.h>
@@ -29,10 +31,27 @@
 #include <sstream>
 #include <string>
 #include <chrono>
+#include <deque>
 #include <functional>
+#include <future>
+#include <numeric>
+#include <optional>
 
 #include <X11/extensions/Xrandr.h>
 
+#include "primus_vk_copy.h"
+#include "primus_vk_pool.h"
+#include "primus_vk_registry.h"
+#include "primus_vk_ring.h"
+#include "primus_vk_names.h"
+#include "primus_vk_device_cache.h"
+#include "primus_vk_memory.h"
+#include "primus_vk_memory_probe.h"
+#include "primus_vk_recycler.h"
+#include "primus_vk_dirty_tiles.h"
+#include "primus_vk_pack.h"
+#include "primus_vk_unpack.h"
+
 #undef VK_LAYER_EXPORT
 #if defined(WIN32)
 #define VK_LAYER_EXPORT extern "C" __declspec(dllexport)
@@ -77,7 +96,6 @@ public:
   uint32_t displayQueueFamilyIndex = 0;
   std::map<void*, std::shared_ptr<CreateOtherDevice>> cod = {};
 
-  std::shared_ptr<std::mutex> renderQueueMutex = std::make_shared<std::mutex>();
   InstanceInfo() = default;
   InstanceInfo(const InstanceInfo &) = delete;
   InstanceInfo(InstanceInfo &&) = default;
@@ -153,26 +171,58 @@ public:
       enumerateDevices(instance, &gpuCount, nullptr);
       physicalDevices.resize(gpuCount);
       enumerateDevices(instance, &gpuCount, physicalDevices.data());
+      physicalDevices.resize(gpuCount);
+    }
+    std::vector<VkPhysicalDeviceProperties> properties(physicalDevices.size());
+    std::vector<DeviceIdentity> identities(physicalDevices.size());
+    for(size_t i = 0; i < physicalDevices.size(); i++){
+      dispatchTable.GetPhysicalDeviceProperties(physicalDevices[i], &properties[i]);
+      identities[i] = deviceIdentity(physicalDevices[i], properties[i], dispatchTable);
+    }
+
+    const char *displayEnv = getenv("PRIMUS_VK_DISPLAYID");
+    const char *renderEnv = getenv("PRIMUS_VK_RENDERID");
+    DeviceSelection selection;
+    selection.displayID = displayEnv != nullptr ? displayEnv : "";
+    selection.renderID = renderEnv != nullptr ? renderEnv : "";
+    if(DeviceSelectionCache::get().find(selection.displayID, selection.renderID, selection)){
+      for(size_t i = 0; i < physicalDevices.size(); i++){
+	const DeviceIdentity &identity = identities[i];
+	if(display == VK_NULL_HANDLE && identity == selection.display){
+	  display = physicalDevices[i];
+	}else if(render == VK_NULL_HANDLE && identity == selection.render){
+	  render = physicalDevices[i];
+	}
+      }
+      if(display != VK_NULL_HANDLE && render != VK_NULL_HANDLE){
+	TRACE("Using the cached device selection");
+	displayQueueFamilyIndex = selection.displayQueueFamilyIndex;
+	renderQueueFamilyIndex = selection.renderQueueFamilyIndex;
+	return VK_SUCCESS;
+      }
+      // a device or its driver changed
+      display = VK_NULL_HANDLE;
+      render = VK_NULL_HANDLE;
     }
 
     TRACE("Searching for display GPU:");
-    for(auto &dev: physicalDevices){
-      VkPhysicalDeviceProperties props;
-      dispatchTable.GetPhysicalDeviceProperties(dev, &props);
-      TRACE(dev << ": " << props.vendorID << ";" << props.deviceID);
+    for(size_t i = 0; i < physicalDevices.size(); i++){
+      const auto &props = properties[i];
+      TRACE(physicalDevices[i] << ": " << props.vendorID << ";" << props.deviceID);
       if(IsDevice(props, displayVendorID, displayDeviceID, VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU)){
-	display = dev;
+	display = physicalDevices[i];
+	selection.display = identities[i];
 	break;
       }
     }
 
     TRACE("Searching for render GPU:");
-    for(auto &dev: physicalDevices){
-      VkPhysicalDeviceProperties props;
-      dispatchTable.GetPhysicalDeviceProperties(dev, &props);
-      TRACE(dev << ".");
+    for(size_t i = 0; i < physicalDevices.size(); i++){
+      const auto &props = properties[i];
+      TRACE(physicalDevices[i] << ".");
       if(IsDevice(props, renderVendorID, renderDeviceID)){
-	render = dev;
+	render = physicalDevices[i];
+	selection.render = identities[i];
 	break;
       }
     }
@@ -199,6 +249,12 @@ public:
     if(ret != VK_SUCCESS){
       return ret;
     }
+    // without device UUIDs the cache can't tell identical devices apart
+    if(selection.display != selection.render){
+      selection.displayQueueFamilyIndex = displayQueueFamilyIndex;
+      selection.renderQueueFamilyIndex = renderQueueFamilyIndex;
+      DeviceSelectionCache::get().store(selection);
+    }
     return VK_SUCCESS;
   }
   VkResult getQueueFamilyIndex(VkPhysicalDevice device, VkLayerInstanceDispatchTable &dispatchTable, uint32_t *queueFamilyIndex) {
@@ -224,14 +280,344 @@ public:
   }
 };
 
-std::map<void *, VkLayerInstanceDispatchTable> instance_dispatch;
+DispatchRegistry<VkLayerInstanceDispatchTable> instance_dispatch;
 VkLayerInstanceDispatchTable loader_dispatch;
 // VkInstance->disp is beeing malloc'ed for every new instance
 // so we can assume it to be a good key.
-std::map<void *, InstanceInfo> instance_info;
+DispatchRegistry<InstanceInfo> instance_info;
+
+DispatchRegistry<InstanceInfo*> device_instance_info;
+DispatchRegistry<VkLayerDispatchTable> device_dispatch;
+
+// The queues that the layer submits to itself: the render queue, which it
+// shares with the application, and the display queue, which is shared by all
+// swapchains of a device. Submissions to them are serialized by their mutex.
+// The application's other queues are left to its own external
+// synchronization and are not locked at all.
+// Keyed by the queue itself, as all queues of a device have the same GetKey.
+DispatchRegistry<std::unique_ptr<std::mutex>> queue_locks;
+
+// Locks `queue` if the layer submits to it as well, the returned lock is empty otherwise.
+std::unique_lock<std::mutex> lockQueue(VkQueue queue){
+  auto *mutex = queue_locks.get(queue);
+  if(mutex == nullptr || !*mutex){
+    return {};
+  }
+  return std::unique_lock<std::mutex>(**mutex);
+}
+
+// The memory of the layer's images and buffers on each device, keyed by the device itself.
+DispatchRegistry<std::unique_ptr<MemoryArena>> memory_arenas;
+
+void createMemoryArena(VkDevice device, VkPhysicalDevice phy){
+  VkPhysicalDeviceProperties props;
+  instance_dispatch[GetKey(phy)].GetPhysicalDeviceProperties(phy, &props);
+  memory_arenas[device].reset(new MemoryArena(device, device_dispatch[GetKey(device)], props.limits));
+}
+MemoryArena &memoryArena(VkDevice device){
+  auto *arena = memory_arenas.get(device);
+  if(arena == nullptr || !*arena){
+    throw std::runtime_error("No memory arena for device.");
+  }
+  return **arena;
+}
 
-std::map<void *, InstanceInfo*> device_instance_info;
-std::map<void *, VkLayerDispatchTable> device_dispatch;
+// The fences, semaphores and command buffers the layer is done with, by device like memory_arenas.
+DispatchRegistry<std::unique_ptr<ObjectRecycler>> recyclers;
+
+void createRecycler(VkDevice device){
+  recyclers[device].reset(new ObjectRecycler(device, device_dispatch[GetKey(device)]));
+}
+ObjectRecycler &recycler(VkDevice device){
+  auto *objects = recyclers.get(device);
+  if(objects == nullptr || !*objects){
+    throw std::runtime_error("No object recycler for device.");
+  }
+  return **objects;
+}
+RecyclerCounts recyclerCounts(VkDevice device){
+  auto *objects = recyclers.get(device);
+  return objects != nullptr && *objects ? (*objects)->counts() : RecyclerCounts{};
+}
+
+bool hasDeviceExtension(VkPhysicalDevice phy, const char *name){
+  auto &dispatch = instance_dispatch[GetKey(phy)];
+  uint32_t count = 0;
+  dispatch.EnumerateDeviceExtensionProperties(phy, nullptr, &count, nullptr);
+  std::vector<VkExtensionProperties> extensions(count);
+  dispatch.EnumerateDeviceExtensionProperties(phy, nullptr, &count, extensions.data());
+  for(const auto &extension: extensions){
+    if(!strcmp(extension.extensionName, name)){
+      return true;
+    }
+  }
+  return false;
+}
+
+void removeExtension(std::vector<const char*> &extensions, const char *name){
+  extensions.erase(std::remove_if(extensions.begin(), extensions.end(), [name](const char *extension){ return !strcmp(extension, name); }), extensions.end());
+}
+
+bool hasExtension(const std::vector<const char*> &extensions, const char *name){
+  for(auto extension: extensions){
+    if(!strcmp(extension, name)){
+      return true;
+    }
+  }
+  return false;
+}
+
+void addExtension(std::vector<const char*> &extensions, const char *name){
+  if(!hasExtension(extensions, name)){
+    extensions.push_back(name);
+  }
+}
+
+// Size of a texel for the formats that are commonly used for swapchains, 0 if unknown.
+uint32_t formatSize(VkFormat format){
+  switch(format){
+  case VK_FORMAT_R5G6B5_UNORM_PACK16:
+  case VK_FORMAT_B5G6R5_UNORM_PACK16:
+  case VK_FORMAT_A1R5G5B5_UNORM_PACK16:
+    return 2;
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+  case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+  case VK_FORMAT_A2R10G10B10_UNORM_PACK32:
+  case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+    return 4;
+  case VK_FORMAT_R16G16B16A16_UNORM:
+  case VK_FORMAT_R16G16B16A16_SFLOAT:
+    return 8;
+  default:
+    return 0;
+  }
+}
+
+// How frames get from the render GPU to the display GPU, selected with PRIMUS_VK_TRANSPORT.
+enum class TransportMode : int{
+  // linear image on each GPU, copied with the CPU ("image")
+  IMAGE_COPY,
+  // one host allocation imported into both GPUs with VK_EXT_external_memory_host ("host")
+  HOST_BRIDGE,
+  // host visible buffer on each GPU with the same row pitch, copied with the CPU ("buffer")
+  BUFFER_COPY,
+};
+std::ostream &operator<<( std::ostream &output, const TransportMode &mode ) {
+  switch(mode){
+  case TransportMode::IMAGE_COPY:
+    output << "image copy";
+    break;
+  case TransportMode::HOST_BRIDGE:
+    output << "host memory bridge";
+    break;
+  case TransportMode::BUFFER_COPY:
+    output << "buffer copy";
+    break;
+  }
+  return output;
+}
+std::string transportSetting(){
+  const char *env = getenv("PRIMUS_VK_TRANSPORT");
+  if(env == nullptr){
+    return "auto";
+  }
+  return env;
+}
+// Alignment of the rows in the transfer buffers, PRIMUS_VK_ROW_ALIGNMENT.
+// Defaults to a cache line, which also suits all of the copy kernels.
+VkDeviceSize rowAlignment(){
+  const char *env = getenv("PRIMUS_VK_ROW_ALIGNMENT");
+  if(env != nullptr){
+    long alignment = strtol(env, nullptr, 10);
+    if(alignment >= 1){
+      return alignment;
+    }
+  }
+  return 64;
+}
+// Number of horizontal chunks a frame is split into with the buffer based
+// transports, PRIMUS_VK_CHUNKS. Each chunk is read back, copied and uploaded
+// on its own, so the three stages overlap within a single frame.
+uint32_t chunkSetting(){
+  const char *env = getenv("PRIMUS_VK_CHUNKS");
+  if(env != nullptr){
+    long chunks = strtol(env, nullptr, 10);
+    if(chunks >= 1){
+      return chunks;
+    }
+  }
+  return 4;
+}
+// Chunks smaller than this are not worth their extra submissions.
+const uint32_t CHUNK_MIN_ROWS = 64;
+
+// Edge length of the tiles that are compared to find the parts of a frame
+// that did not change. PRIMUS_VK_DIRTY_TILES=1 hashes them on the CPU after
+// readback, PRIMUS_VK_DIRTY_TILES=gpu compares them on the render GPU before.
+const uint32_t DIRTY_TILE_SIZE = 64;
+std::string dirtyTileSetting(){
+  const char *env = getenv("PRIMUS_VK_DIRTY_TILES");
+  if(env == nullptr){
+    return "";
+  }
+  return env;
+}
+
+// PRIMUS_VK_SCALE transfers frames at a reduced resolution, which the display
+// GPU scales back up. It is either a fixed factor like 0.75 or "auto", which
+// only lowers the resolution as far as needed to transfer a frame within the
+// frame budget of PRIMUS_VK_SCALE_FPS. Factors are multiples of 1/SCALE_STEPS.
+const uint32_t SCALE_STEPS = 8;
+const uint32_t SCALE_MIN_STEPS = 4;
+std::string scaleSetting(){
+  const char *env = getenv("PRIMUS_VK_SCALE");
+  if(env == nullptr){
+    return "";
+  }
+  return env;
+}
+// PRIMUS_VK_PACKING packs frames into a smaller encoding on the render GPU,
+// which the display GPU unpacks again: rgb888 drops the alpha channel, rgb565
+// and yuv420 trade colour precision for even less bandwidth. "lossless" only
+// allows rgb888.
+enum class PackingMode : uint32_t {
+  // the values are the modes of primus_vk_pack.comp
+  NONE = 0,
+  RGB888 = 1,
+  RGB565 = 2,
+  YUV420 = 3,
+};
+std::ostream &operator<<(std::ostream &output, const PackingMode &mode){
+  switch(mode){
+  case PackingMode::NONE:
+    output << "none";
+    break;
+  case PackingMode::RGB888:
+    output << "RGB888";
+    break;
+  case PackingMode::RGB565:
+    output << "RGB565";
+    break;
+  case PackingMode::YUV420:
+    output << "YUV420";
+    break;
+  }
+  return output;
+}
+std::string packingSetting(){
+  const char *env = getenv("PRIMUS_VK_PACKING");
+  if(env == nullptr){
+    return "";
+  }
+  return env;
+}
+// The encodings expect 8 bit RGBA texels. Dropping the alpha channel is only
+// lossless when the compositor ignores it.
+PackingMode choosePacking(const std::string &request, const VkSwapchainCreateInfoKHR &createInfo){
+  switch(createInfo.imageFormat){
+  case VK_FORMAT_R8G8B8A8_UNORM:
+  case VK_FORMAT_R8G8B8A8_SRGB:
+  case VK_FORMAT_B8G8R8A8_UNORM:
+  case VK_FORMAT_B8G8R8A8_SRGB:
+  case VK_FORMAT_A8B8G8R8_UNORM_PACK32:
+  case VK_FORMAT_A8B8G8R8_SRGB_PACK32:
+    break;
+  default:
+    return PackingMode::NONE;
+  }
+  if(createInfo.compositeAlpha != VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR){
+    return PackingMode::NONE;
+  }
+  if(request == "rgb888" || request == "lossless"){
+    return PackingMode::RGB888;
+  }else if(request == "rgb565"){
+    return PackingMode::RGB565;
+  }else if(request == "yuv420"){
+    return PackingMode::YUV420;
+  }
+  return PackingMode::NONE;
+}
+
+double scaleBudget(){
+  const char *env = getenv("PRIMUS_VK_SCALE_FPS");
+  double fps = env == nullptr ? 0 : strtod(env, nullptr);
+  if(fps <= 0){
+    fps = 60;
+  }
+  return 1 / fps;
+}
+
+// PRIMUS_VK_FPS limits the frame rate of the application, 0 if it is not limited.
+double fpsLimitSetting(){
+  const char *env = getenv("PRIMUS_VK_FPS");
+  const double fps = env == nullptr ? 0 : strtod(env, nullptr);
+  return fps > 0 ? fps : 0;
+}
+// PRIMUS_VK_PACING=1 starts every frame just in time for the display, see FramePacer.
+bool pacingSetting(){
+  const char *env = getenv("PRIMUS_VK_PACING");
+  return env != nullptr && std::string{env} == "1";
+}
+
+// The render GPU reads frames back on a queue of the layer's own, unless
+// PRIMUS_VK_TRANSFER_QUEUE=0. It comes from the family with the fewest other
+// capabilities that the transfer settings allow: scaling blits and needs a
+// graphics queue, dirty tiles on the GPU and packing need a compute queue,
+// everything else runs on a transfer only queue.
+bool transferQueueSetting(){
+  const char *env = getenv("PRIMUS_VK_TRANSFER_QUEUE");
+  return env == nullptr || std::string{env} != "0";
+}
+// PRIMUS_VK_MAILBOX=1 drops a queued frame instead of presenting it when a
+// newer one was read back already, like VK_PRESENT_MODE_MAILBOX_KHR does.
+bool mailboxSetting(){
+  const char *env = getenv("PRIMUS_VK_MAILBOX");
+  return env != nullptr && std::string{env} == "1";
+}
+VkQueueFlags transferQueueFlags(){
+  if(!scaleSetting().empty()){
+    return VK_QUEUE_GRAPHICS_BIT;
+  }
+  if(!packingSetting().empty() || dirtyTileSetting() == "gpu"){
+    return VK_QUEUE_COMPUTE_BIT;
+  }
+  return VK_QUEUE_TRANSFER_BIT;
+}
+
+// The parts of a swapchain image that need to be transferred, from the
+// VkPresentRegionsKHR of VK_KHR_incremental_present. An empty list stands for
+// the whole image.
+typedef std::vector<VkRect2D> Damage;
+// More rectangles than this are merged into their bounding box.
+const size_t DAMAGE_MAX_RECTS = 16;
+
+VkRect2D intersectRect(const VkRect2D &a, const VkRect2D &b){
+  const int64_t x0 = std::max(a.offset.x, b.offset.x);
+  const int64_t y0 = std::max(a.offset.y, b.offset.y);
+  const int64_t x1 = std::min(int64_t{a.offset.x} + a.extent.width, int64_t{b.offset.x} + b.extent.width);
+  const int64_t y1 = std::min(int64_t{a.offset.y} + a.extent.height, int64_t{b.offset.y} + b.extent.height);
+  if(x1 <= x0 || y1 <= y0){
+    return VkRect2D{{int32_t(x0), int32_t(y0)}, {0, 0}};
+  }
+  return VkRect2D{{int32_t(x0), int32_t(y0)}, {uint32_t(x1 - x0), uint32_t(y1 - y0)}};
+}
+void limitDamage(Damage &damage){
+  if(damage.size() <= DAMAGE_MAX_RECTS){
+    return;
+  }
+  int64_t x0 = damage[0].offset.x, y0 = damage[0].offset.y, x1 = x0, y1 = y0;
+  for(const auto &rect: damage){
+    x0 = std::min<int64_t>(x0, rect.offset.x);
+    y0 = std::min<int64_t>(y0, rect.offset.y);
+    x1 = std::max<int64_t>(x1, rect.offset.x + int64_t{rect.extent.width});
+    y1 = std::max<int64_t>(y1, rect.offset.y + int64_t{rect.extent.height});
+  }
+  damage = {VkRect2D{{int32_t(x0), int32_t(y0)}, {uint32_t(x1 - x0), uint32_t(y1 - y0)}}};
+}
 
 ///////////////////////////////////////////////////////////////////////////////////////////
 // Layer init and shutdown
@@ -282,11 +668,21 @@ VkResult VKAPI_CALL PrimusVK_CreateInstance(
   FORWARD(GetPhysicalDeviceProperties);
   FORWARD(GetPhysicalDeviceQueueFamilyProperties);
 #undef FORWARD
+  // only callable if the application enabled it, left null otherwise
+  const uint32_t instanceVersion = pCreateInfo->pApplicationInfo != nullptr ? pCreateInfo->pApplicationInfo->apiVersion : 0;
+  const std::vector<const char*> instanceExtensions{pCreateInfo->ppEnabledExtensionNames, pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount};
+  dispatchTable.GetPhysicalDeviceProperties2 = nullptr;
+  if(instanceVersion >= VK_API_VERSION_1_1){
+    dispatchTable.GetPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2)gpa(*pInstance, "vkGetPhysicalDeviceProperties2");
+  }else if(hasExtension(instanceExtensions, VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME)){
+    dispatchTable.GetPhysicalDeviceProperties2 = (PFN_vkGetPhysicalDeviceProperties2)gpa(*pInstance, "vkGetPhysicalDeviceProperties2KHR");
+  }
 
   auto my_instance_info = InstanceInfo{*pInstance, layerCreateDevice, layerDestroyDevice};
 #define FORWARD(func) dispatchTable.func = (PFN_vk##func)gpa(*pInstance, "vk" #func);
   FORWARD(GetPhysicalDeviceSurfaceCapabilities2KHR);
   FORWARD(GetPhysicalDeviceMemoryProperties);
+  FORWARD(GetPhysicalDeviceFormatProperties);
   FORWARD(GetPhysicalDeviceQueueFamilyProperties);
 #ifdef VK_USE_PLATFORM_XCB_KHR
   FORWARD(GetPhysicalDeviceXcbPresentationSupportKHR);
@@ -322,23 +718,23 @@ void VKAPI_CALL PrimusVK_DestroyInstance(VkInstance instance, const VkAllocation
   instance_info.erase(instance_key);
 }
 
-struct FramebufferImage;
+// The persistent mapping of a block of the arena, at an allocation.
 struct MappedMemory{
-  VkDevice device;
-  VkDeviceMemory mem;
   char* data;
-  MappedMemory(VkDevice device, FramebufferImage &img);
-  ~MappedMemory();
+  MappedMemory(VkDevice device, const MemoryArena::Allocation &allocation): data(memoryArena(device).map(allocation)){}
 };
 struct FramebufferImage {
   VkImage img;
   VkDeviceMemory mem;
+  MemoryArena::Allocation allocation;
+  uint32_t memory_type;
 
   VkDevice device;
 
   std::shared_ptr<MappedMemory> mapped;
   FramebufferImage(FramebufferImage &) = delete;
   FramebufferImage(VkDevice device, VkExtent2D size, VkImageTiling tiling, VkImageUsageFlags usage, VkFormat format, std::function<uint32_t(uint32_t memory_type_bits)> memoryTypeIndex): device(device){
+    auto &dispatch = device_dispatch[GetKey(device)];
     TRACE("Creating image: " << size.width << "x" << size.height);
     VkImageCreateInfo imageCreateCI {};
     imageCreateCI.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
@@ -353,15 +749,19 @@ struct FramebufferImage {
     imageCreateCI.samples = VK_SAMPLE_COUNT_1_BIT;
     imageCreateCI.tiling = tiling;
     imageCreateCI.usage = usage;
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].CreateImage(device, &imageCreateCI, nullptr, &img));
+    VK_CHECK_RESULT(dispatch.CreateImage(device, &imageCreateCI, nullptr, &img));
 
     VkMemoryRequirements memRequirements {};
-    VkMemoryAllocateInfo memAllocInfo {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
-    device_dispatch[GetKey(device)].GetImageMemoryRequirements(device, img, &memRequirements);
-    memAllocInfo.allocationSize = memRequirements.size;
-    memAllocInfo.memoryTypeIndex = memoryTypeIndex(memRequirements.memoryTypeBits);
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].AllocateMemory(device, &memAllocInfo, nullptr, &mem));
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].BindImageMemory(device, img, mem, 0));
+    dispatch.GetImageMemoryRequirements(device, img, &memRequirements);
+    try {
+      memory_type = memoryTypeIndex(memRequirements.memoryTypeBits);
+      allocation = memoryArena(device).allocate(memRequirements, memory_type);
+    }catch(...){
+      dispatch.DestroyImage(device, img, nullptr);
+      throw;
+    }
+    mem = allocation.memory;
+    VK_CHECK_RESULT(dispatch.BindImageMemory(device, img, mem, allocation.offset));
   }
   std::shared_ptr<MappedMemory> getMapped(){
     if(!mapped){
@@ -370,7 +770,14 @@ struct FramebufferImage {
     return mapped;
   }
   void map(){
-    mapped = std::make_shared<MappedMemory>(device, *this);
+    // a recycled one is still mapped
+    if(!mapped){
+      mapped = std::make_shared<MappedMemory>(device, allocation);
+    }
+  }
+  // the part of the block's mapping that belongs to this one
+  VkMappedMemoryRange mappedRange() const {
+    return VkMappedMemoryRange{VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, mem, allocation.offset, allocation.size};
   }
   VkSubresourceLayout getLayout(){
     VkImageSubresource subResource { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0 };
@@ -380,26 +787,183 @@ struct FramebufferImage {
   }
   ~FramebufferImage(){
     mapped.reset();
-    device_dispatch[GetKey(device)].FreeMemory(device, mem, nullptr);
     device_dispatch[GetKey(device)].DestroyImage(device, img, nullptr);
+    memoryArena(device).free(allocation);
+  }
+};
+struct FramebufferBuffer {
+  VkBuffer buf;
+  VkDeviceMemory mem;
+  MemoryArena::Allocation allocation;
+  uint32_t memory_type;
+  VkDeviceSize size;
+
+  VkDevice device;
+
+  std::shared_ptr<MappedMemory> mapped;
+  FramebufferBuffer(FramebufferBuffer &) = delete;
+  FramebufferBuffer(VkDevice device, VkDeviceSize size, VkBufferUsageFlags usage, std::function<uint32_t(uint32_t memory_type_bits)> memoryTypeIndex): size(size), device(device){
+    auto &dispatch = device_dispatch[GetKey(device)];
+    TRACE("Creating buffer: " << size << " bytes");
+    VkBufferCreateInfo bufferCI {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferCI.size = size;
+    bufferCI.usage = usage;
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(dispatch.CreateBuffer(device, &bufferCI, nullptr, &buf) != VK_SUCCESS){
+      throw std::runtime_error("Creating buffer failed");
+    }
+
+    VkMemoryRequirements memRequirements {};
+    dispatch.GetBufferMemoryRequirements(device, buf, &memRequirements);
+    try {
+      memory_type = memoryTypeIndex(memRequirements.memoryTypeBits);
+      allocation = memoryArena(device).allocate(memRequirements, memory_type);
+    }catch(...){
+      dispatch.DestroyBuffer(device, buf, nullptr);
+      throw;
+    }
+    mem = allocation.memory;
+    if(dispatch.BindBufferMemory(device, buf, mem, allocation.offset) != VK_SUCCESS){
+      dispatch.DestroyBuffer(device, buf, nullptr);
+      memoryArena(device).free(allocation);
+      throw std::runtime_error("Binding buffer memory failed");
+    }
+  }
+  std::shared_ptr<MappedMemory> getMapped(){
+    if(!mapped){
+      throw std::runtime_error("not mapped");
+    }
+    return mapped;
+  }
+  void map(){
+    // a recycled one is still mapped
+    if(!mapped){
+      mapped = std::make_shared<MappedMemory>(device, allocation);
+    }
+  }
+  // the part of the block's mapping that belongs to this one
+  VkMappedMemoryRange mappedRange() const {
+    return VkMappedMemoryRange{VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE, nullptr, mem, allocation.offset, allocation.size};
+  }
+  ~FramebufferBuffer(){
+    mapped.reset();
+    device_dispatch[GetKey(device)].DestroyBuffer(device, buf, nullptr);
+    memoryArena(device).free(allocation);
+  }
+};
+// A buffer whose memory is host memory owned by the layer, imported with VK_EXT_external_memory_host.
+struct ImportedBuffer {
+  VkDevice device;
+  VkBuffer buf = VK_NULL_HANDLE;
+  VkDeviceMemory mem = VK_NULL_HANDLE;
+  // only mapped when the memory type is not coherent, so that CPU reads can be invalidated
+  bool mapped = false;
+
+  ImportedBuffer(ImportedBuffer &) = delete;
+  ImportedBuffer(VkDevice device, const VkPhysicalDeviceMemoryProperties &props, void *host, VkDeviceSize size, VkBufferUsageFlags usage): device(device){
+    auto &dispatch = device_dispatch[GetKey(device)];
+    VkExternalMemoryBufferCreateInfo externalCI {.sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_BUFFER_CREATE_INFO};
+    externalCI.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    VkBufferCreateInfo bufferCI {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+    bufferCI.pNext = &externalCI;
+    bufferCI.size = size;
+    bufferCI.usage = usage;
+    bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+    if(dispatch.CreateBuffer(device, &bufferCI, nullptr, &buf) != VK_SUCCESS){
+      throw std::runtime_error("Creating buffer for host memory failed");
+    }
+
+    VkMemoryRequirements memRequirements {};
+    dispatch.GetBufferMemoryRequirements(device, buf, &memRequirements);
+    VkMemoryHostPointerPropertiesEXT hostProperties {.sType = VK_STRUCTURE_TYPE_MEMORY_HOST_POINTER_PROPERTIES_EXT};
+    VK_CHECK_RESULT(dispatch.GetMemoryHostPointerPropertiesEXT(device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT, host, &hostProperties));
+    uint32_t memoryTypeBits = memRequirements.memoryTypeBits & hostProperties.memoryTypeBits;
+    if(memoryTypeBits == 0){
+      dispatch.DestroyBuffer(device, buf, nullptr);
+      throw std::runtime_error("No memory type for imported host memory");
+    }
+
+    VkImportMemoryHostPointerInfoEXT importInfo {.sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_HOST_POINTER_INFO_EXT};
+    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_HOST_ALLOCATION_BIT_EXT;
+    importInfo.pHostPointer = host;
+    VkMemoryAllocateInfo memAllocInfo {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    memAllocInfo.pNext = &importInfo;
+    memAllocInfo.allocationSize = size;
+    uint32_t coherentBits = 0;
+    for(uint32_t i = 0; i < props.memoryTypeCount; i++){
+      if((memoryTypeBits & (1u << i)) != 0 && (props.memoryTypes[i].propertyFlags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT) != 0){
+	coherentBits |= 1u << i;
+      }
+    }
+    memAllocInfo.memoryTypeIndex = __builtin_ctz(coherentBits != 0 ? coherentBits : memoryTypeBits);
+    if(dispatch.AllocateMemory(device, &memAllocInfo, nullptr, &mem) != VK_SUCCESS){
+      dispatch.DestroyBuffer(device, buf, nullptr);
+      throw std::runtime_error("Importing host memory failed");
+    }
+    if(dispatch.BindBufferMemory(device, buf, mem, 0) != VK_SUCCESS){
+      dispatch.DestroyBuffer(device, buf, nullptr);
+      dispatch.FreeMemory(device, mem, nullptr);
+      throw std::runtime_error("Binding imported host memory failed");
+    }
+    const VkMemoryPropertyFlags flags = props.memoryTypes[memAllocInfo.memoryTypeIndex].propertyFlags;
+    if(coherentBits == 0 && (flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) != 0){
+      void *address;
+      mapped = dispatch.MapMemory(device, mem, 0, VK_WHOLE_SIZE, 0, &address) == VK_SUCCESS;
+    }
+  }
+  // What the CPU needs to invalidate before it reads the host memory, no memory if nothing.
+  VkMappedMemoryRange mappedRange() const {
+    VkMappedMemoryRange range {.sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE};
+    if(mapped){
+      range.memory = mem;
+      range.size = VK_WHOLE_SIZE;
+    }
+    return range;
+  }
+  ~ImportedBuffer(){
+    if(mapped){
+      device_dispatch[GetKey(device)].UnmapMemory(device, mem);
+    }
+    device_dispatch[GetKey(device)].DestroyBuffer(device, buf, nullptr);
+    device_dispatch[GetKey(device)].FreeMemory(device, mem, nullptr);
+  }
+};
+// Page-aligned host memory that is imported into both GPUs, so the render GPU
+// writes the frame to where the display GPU reads it, without a CPU copy.
+struct HostBridge {
+  void *host;
+  std::unique_ptr<ImportedBuffer> render;
+  std::unique_ptr<ImportedBuffer> display;
+
+  HostBridge(HostBridge &) = delete;
+  HostBridge(VkDevice render_device, const VkPhysicalDeviceMemoryProperties &render_props, VkDevice display_device, const VkPhysicalDeviceMemoryProperties &display_props, VkDeviceSize size, VkDeviceSize alignment){
+    size = (size + alignment - 1) / alignment * alignment;
+    host = aligned_alloc(alignment, size);
+    if(host == nullptr){
+      throw std::runtime_error("Allocating host memory failed");
+    }
+    try {
+      render = std::unique_ptr<ImportedBuffer>(new ImportedBuffer(render_device, render_props, host, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT));
+      display = std::unique_ptr<ImportedBuffer>(new ImportedBuffer(display_device, display_props, host, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT));
+    }catch(...){
+      render.reset();
+      free(host);
+      throw;
+    }
+  }
+  ~HostBridge(){
+    render.reset();
+    display.reset();
+    free(host);
   }
 };
-MappedMemory::MappedMemory(VkDevice device, FramebufferImage &img): device(device), mem(img.mem){
-  device_dispatch[GetKey(device)].MapMemory(device, img.mem, 0, VK_WHOLE_SIZE, 0, (void**)&data);
-}
-MappedMemory::~MappedMemory(){
-  device_dispatch[GetKey(device)].UnmapMemory(device, mem);
-}
 class CommandBuffer;
 class Fence{
   VkDevice device;
 public:
   VkFence fence;
-  Fence(VkDevice dev): device(dev){
-    // Create fence to ensure that the command buffer has finished executing
-    VkFenceCreateInfo fenceInfo = {.sType=VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
-    fenceInfo.flags = 0;
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].CreateFence(device, &fenceInfo, nullptr, &fence));
+  // to ensure that the command buffer has finished executing
+  Fence(VkDevice dev): device(dev), fence(recycler(dev).fence()){
   }
   void await(){
     // Wait for the fence to signal that command buffer has finished executing
@@ -408,12 +972,15 @@ public:
   void reset(){
     VK_CHECK_RESULT(device_dispatch[GetKey(device)].ResetFences(device, 1, &fence));
   }
+  bool signaled(){
+    return device_dispatch[GetKey(device)].GetFenceStatus(device, fence) == VK_SUCCESS;
+  }
   Fence(Fence &&other): device(other.device), fence(other.fence){
     other.fence = VK_NULL_HANDLE;
   }
   ~Fence(){
     if(fence != VK_NULL_HANDLE){
-      device_dispatch[GetKey(device)].DestroyFence(device, fence, nullptr);
+      recycler(device).give(fence);
     }
   }
 };
@@ -421,25 +988,365 @@ class Semaphore{
   VkDevice device;
 public:
   VkSemaphore sem;
-  Semaphore(VkDevice dev): device(dev){
-    VkSemaphoreCreateInfo semInfo = {.sType=VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
-    semInfo.flags = 0;
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].CreateSemaphore(device, &semInfo, nullptr, &sem));
+  // set when a signal may not have been waited for, the semaphore is destroyed then
+  bool may_be_signaled = false;
+  Semaphore(VkDevice dev): device(dev), sem(recycler(dev).semaphore()){
   }
-  Semaphore(Semaphore &&other): device(other.device), sem(other.sem) {
+  Semaphore(Semaphore &&other): device(other.device), sem(other.sem), may_be_signaled(other.may_be_signaled) {
     other.sem = VK_NULL_HANDLE;
     other.device = VK_NULL_HANDLE;
   }
   ~Semaphore(){
     if(sem != VK_NULL_HANDLE){
-      device_dispatch[GetKey(device)].DestroySemaphore(device, sem, nullptr);
+      recycler(device).give(sem, !may_be_signaled);
     }
   }
 };
+
+// Two timestamps, written around the render side of a transfer.
+class TimestampQueries{
+  VkDevice device;
+  // seconds per tick
+  double period;
+  uint64_t valid_mask;
+public:
+  VkQueryPool pool;
+  TimestampQueries(const TimestampQueries &) = delete;
+  TimestampQueries(VkDevice device, float timestampPeriod, uint32_t validBits): device(device), period(timestampPeriod * 1e-9){
+    valid_mask = validBits >= 64 ? ~uint64_t{0} : (uint64_t{1} << validBits) - 1;
+    VkQueryPoolCreateInfo poolInfo = {.sType=VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+    poolInfo.queryCount = 2;
+    VK_CHECK_RESULT(device_dispatch[GetKey(device)].CreateQueryPool(device, &poolInfo, nullptr, &pool));
+  }
+  // 0 if the timestamps are not available (yet)
+  double elapsed(){
+    uint64_t ticks[2];
+    VkResult res = device_dispatch[GetKey(device)].GetQueryPoolResults(device, pool, 0, 2, sizeof(ticks), ticks, sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    if(res != VK_SUCCESS){
+      return 0;
+    }
+    return ((ticks[1] - ticks[0]) & valid_mask) * period;
+  }
+  ~TimestampQueries(){
+    device_dispatch[GetKey(device)].DestroyQueryPool(device, pool, nullptr);
+  }
+};
+
+// Picks the scale factor of PRIMUS_VK_SCALE=auto. The time needed to read
+// back and copy a frame grows with its area, so the factor is lowered by a
+// step while the average transfer takes most of the frame budget, and raised
+// again once the next larger size is expected to fit with room to spare.
+class ScaleController{
+  std::mutex lock;
+  bool adaptive = false;
+  double budget = 0;
+  double average = 0;
+  uint32_t frames = 0;
+  // frames to average before the next decision
+  static const uint32_t SETTLE_FRAMES = 30;
+public:
+  std::atomic<uint32_t> steps{SCALE_STEPS};
+  void configure(uint32_t fixed_steps, bool adaptive, double budget){
+    steps = fixed_steps;
+    this->adaptive = adaptive;
+    this->budget = budget;
+  }
+  void update(double transfer_secs){
+    if(!adaptive){
+      return;
+    }
+    std::unique_lock<std::mutex> l(lock);
+    average = frames == 0 ? transfer_secs : average * 0.9 + transfer_secs * 0.1;
+    if(++frames < SETTLE_FRAMES){
+      return;
+    }
+    const uint32_t current = steps;
+    uint32_t next = current;
+    if(average > budget * 0.9 && current > SCALE_MIN_STEPS){
+      next = current - 1;
+    }else if(current < SCALE_STEPS && average * (current + 1) * (current + 1) / (current * current) < budget * 0.7){
+      next = current + 1;
+    }
+    if(next != current){
+      TRACE("Transport scale: " << next << "/" << SCALE_STEPS << " (" << average * 1000 << " ms per frame)");
+      steps = next;
+      frames = 0;
+    }
+  }
+};
+// Decides when AcquireNextImage lets the application start its next frame.
+// With a frame rate limit, frames are started at most that often. With just
+// in time pacing, the interval at which the display takes frames and the
+// time the application, the readback and the copy need are learned from the
+// last frames, and the frame is started so that it is ready shortly before
+// the display takes the next one, instead of racing ahead and waiting in the
+// queue with stale input.
+//
+// The refresh interval is not learned from the layer's own presents, which
+// follow the paced frames. A display acquire that had to wait returns when
+// the presentation engine let go of an image, i.e. at a refresh, so the
+// refresh interval is the median of the last intervals between two such
+// acquires in a row, leaving out the first frames of the swapchain and
+// intervals far off the median either way. Those acquires also anchor the
+// phase of the refreshes. Once the frames are paced, the acquires stop
+// waiting, and an error in the interval adds up from frame to frame; so when
+// none waited for a while, pacing is paused until the frames running ahead
+// make them wait again.
+class FramePacer{
+  using clock = std::chrono::steady_clock;
+  std::mutex lock;
+  double limit_interval = 0;
+  bool just_in_time = false;
+  clock::time_point next_start;
+  clock::time_point last_acquire;
+  // the last display acquire that returned at a refresh, unset while pacing is paused
+  clock::time_point last_refresh;
+  bool last_waited = false;
+  uint32_t unwaited = 0;
+  uint32_t display_acquires = 0;
+  std::array<double, 15> intervals;
+  size_t interval_count = 0;
+  size_t rejected = 0;
+  // seconds between refreshes, the median of `intervals`
+  double refresh = 0;
+  // averages in seconds: from acquire to present in the application, and
+  // from readback to upload in the layer
+  double render = 0;
+  double transfer = 0;
+  // how early a just in time frame is meant to be ready
+  static constexpr double SLACK = 0.002;
+  // display acquires taken while the swapchain fills up
+  static constexpr uint32_t WARMUP_ACQUIRES = 8;
+  // shorter display acquires did not wait for a refresh
+  static constexpr double ACQUIRE_WAIT = 0.0005;
+  static constexpr size_t MIN_INTERVALS = 5;
+  // display acquires without a wait after which the phase is too old to pace by
+  static constexpr uint32_t STALE_ACQUIRES = 15;
+
+  void learnRefresh(double interval){
+    if(interval_count >= MIN_INTERVALS && (interval < refresh * 0.5 || interval > refresh * 1.5)){
+      // a missed refresh or a late wakeup; a whole window of them means the display changed
+      if(++rejected < intervals.size()){
+	return;
+      }
+      interval_count = 0;
+    }
+    rejected = 0;
+    intervals[interval_count++ % intervals.size()] = interval;
+    if(interval_count < MIN_INTERVALS){
+      return;
+    }
+    std::array<double, 15> sorted = intervals;
+    const size_t count = std::min(interval_count, intervals.size());
+    std::nth_element(sorted.begin(), sorted.begin() + count / 2, sorted.begin() + count);
+    refresh = sorted[count / 2];
+  }
+
+  static double average(double average, double sample){
+    return average == 0 ? sample : average * 0.9 + sample * 0.1;
+  }
+  static clock::duration seconds(double secs){
+    return std::chrono::duration_cast<clock::duration>(std::chrono::duration<double>(secs));
+  }
+public:
+  void configure(double fps, bool jit){
+    limit_interval = fps > 0 ? 1 / fps : 0;
+    just_in_time = jit;
+  }
+  bool enabled() const {
+    return limit_interval > 0 || just_in_time;
+  }
+  // Sleeps until the application should start its next frame, false if
+  // that is after `deadline`, which is only slept until then.
+  bool pace(clock::time_point deadline){
+    const auto now = clock::now();
+    clock::time_point start = now;
+    {
+      std::unique_lock<std::mutex> l(lock);
+      // a frame that was late does not make the next ones early
+      const clock::time_point limited = std::max(next_start, now - seconds(limit_interval));
+      if(limit_interval > 0){
+	start = limited;
+      }
+      if(just_in_time && refresh > 0 && last_refresh != clock::time_point{}){
+	const double needed = render + transfer + SLACK;
+	// the first time the display takes a frame that this one can still be ready for
+	const double since = std::chrono::duration<double>(now - last_refresh).count();
+	const double slots = std::max(1.0, std::ceil((since + needed) / refresh));
+	start = std::max(start, last_refresh + seconds(slots * refresh - needed));
+      }
+      if(start > deadline){
+	l.unlock();
+	std::this_thread::sleep_until(deadline);
+	return false;
+      }
+      if(limit_interval > 0){
+	next_start = limited + seconds(limit_interval);
+      }
+    }
+    if(start > now){
+      std::this_thread::sleep_until(start);
+    }
+    return true;
+  }
+  void acquired(){
+    std::unique_lock<std::mutex> l(lock);
+    last_acquire = clock::now();
+  }
+  void queued(){
+    std::unique_lock<std::mutex> l(lock);
+    if(last_acquire != clock::time_point{}){
+      render = average(render, std::chrono::duration<double>(clock::now() - last_acquire).count());
+    }
+  }
+  void transferred(double secs){
+    std::unique_lock<std::mutex> l(lock);
+    transfer = average(transfer, secs);
+  }
+  // A display acquire that was started at `start` returned.
+  void displayAcquired(clock::time_point start){
+    const auto now = clock::now();
+    std::unique_lock<std::mutex> l(lock);
+    const bool waited = std::chrono::duration<double>(now - start).count() > ACQUIRE_WAIT;
+    if(++display_acquires <= WARMUP_ACQUIRES || !waited){
+      last_waited = false;
+      if(display_acquires > WARMUP_ACQUIRES && ++unwaited >= STALE_ACQUIRES){
+	last_refresh = clock::time_point{};
+      }
+      return;
+    }
+    unwaited = 0;
+    if(last_waited){
+      learnRefresh(std::chrono::duration<double>(now - last_refresh).count());
+    }
+    last_refresh = now;
+    last_waited = true;
+  }
+  void log(){
+    std::unique_lock<std::mutex> l(lock);
+    TRACE("Pacing: " << refresh * 1000 << " ms between refreshes, " << render * 1000 << " ms rendering, " << transfer * 1000 << " ms transferring");
+  }
+};
+// Push constants of primus_vk_dirty_tiles.comp
+struct DirtyTileParams {
+  uint32_t first_tile_row;
+  uint32_t tiles_x;
+  uint32_t row_pitch;
+  uint32_t row_size;
+  uint32_t tile_width;
+  uint32_t height;
+  uint32_t force;
+};
+// Push constants of primus_vk_pack.comp and primus_vk_unpack.comp
+struct PackParams {
+  uint32_t mode;
+  uint32_t width;
+  uint32_t height;
+  uint32_t row_pitch;
+  uint32_t packed_pitch;
+  uint32_t swap_rb;
+  // a workgroup covers 8x8 blocks of 4x2 texels
+  uint32_t groupsX() const { return (width + 31) / 32; }
+  uint32_t groupsY() const { return (height + 15) / 16; }
+};
+// A compute pipeline for one of the layer's shaders, whose bindings are all
+// storage buffers, with a descriptor set for each swapchain image.
+struct ComputePipeline {
+  VkDevice device;
+  uint32_t binding_count;
+  VkShaderModule shader = VK_NULL_HANDLE;
+  VkDescriptorSetLayout set_layout = VK_NULL_HANDLE;
+  VkPipelineLayout layout = VK_NULL_HANDLE;
+  VkPipeline pipeline = VK_NULL_HANDLE;
+  VkDescriptorPool pool = VK_NULL_HANDLE;
+  // the image workers of a swapchain allocate their sets concurrently
+  std::mutex pool_lock;
+
+  ComputePipeline(const ComputePipeline &) = delete;
+  ComputePipeline(VkDevice device, const uint32_t *code, size_t codeSize, uint32_t binding_count, uint32_t constantsSize, uint32_t set_count): device(device), binding_count(binding_count){
+    auto &dispatch = device_dispatch[GetKey(device)];
+    VkShaderModuleCreateInfo shaderCI {.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO};
+    shaderCI.codeSize = codeSize;
+    shaderCI.pCode = code;
+    VK_CHECK_RESULT(dispatch.CreateShaderModule(device, &shaderCI, nullptr, &shader));
+
+    std::vector<VkDescriptorSetLayoutBinding> bindings(binding_count);
+    for(uint32_t i = 0; i < binding_count; i++){
+      bindings[i].binding = i;
+      bindings[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      bindings[i].descriptorCount = 1;
+      bindings[i].stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+    }
+    VkDescriptorSetLayoutCreateInfo setLayoutCI {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO};
+    setLayoutCI.bindingCount = binding_count;
+    setLayoutCI.pBindings = bindings.data();
+    VK_CHECK_RESULT(dispatch.CreateDescriptorSetLayout(device, &setLayoutCI, nullptr, &set_layout));
+
+    VkPushConstantRange constants {VK_SHADER_STAGE_COMPUTE_BIT, 0, constantsSize};
+    VkPipelineLayoutCreateInfo layoutCI {.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO};
+    layoutCI.setLayoutCount = 1;
+    layoutCI.pSetLayouts = &set_layout;
+    layoutCI.pushConstantRangeCount = 1;
+    layoutCI.pPushConstantRanges = &constants;
+    VK_CHECK_RESULT(dispatch.CreatePipelineLayout(device, &layoutCI, nullptr, &layout));
+
+    VkComputePipelineCreateInfo pipelineCI {.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO};
+    pipelineCI.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+    pipelineCI.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+    pipelineCI.stage.module = shader;
+    pipelineCI.stage.pName = "main";
+    pipelineCI.layout = layout;
+    VK_CHECK_RESULT(dispatch.CreateComputePipelines(device, VK_NULL_HANDLE, 1, &pipelineCI, nullptr, &pipeline));
+
+    VkDescriptorPoolSize poolSize {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, binding_count * set_count};
+    VkDescriptorPoolCreateInfo poolCI {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO};
+    poolCI.maxSets = set_count;
+    poolCI.poolSizeCount = 1;
+    poolCI.pPoolSizes = &poolSize;
+    VK_CHECK_RESULT(dispatch.CreateDescriptorPool(device, &poolCI, nullptr, &pool));
+  }
+  // one buffer for each binding, in the order of the shader's bindings
+  VkDescriptorSet allocateSet(const std::vector<VkBuffer> &buffers){
+    VkDescriptorSet set;
+    VkDescriptorSetAllocateInfo allocInfo {.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO};
+    allocInfo.descriptorPool = pool;
+    allocInfo.descriptorSetCount = 1;
+    allocInfo.pSetLayouts = &set_layout;
+    {
+      std::lock_guard<std::mutex> lock(pool_lock);
+      VK_CHECK_RESULT(device_dispatch[GetKey(device)].AllocateDescriptorSets(device, &allocInfo, &set));
+    }
+
+    std::vector<VkDescriptorBufferInfo> infos(binding_count);
+    std::vector<VkWriteDescriptorSet> writes(binding_count);
+    for(uint32_t i = 0; i < binding_count; i++){
+      infos[i] = VkDescriptorBufferInfo{buffers[i], 0, VK_WHOLE_SIZE};
+      writes[i] = VkWriteDescriptorSet{.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
+      writes[i].dstSet = set;
+      writes[i].dstBinding = i;
+      writes[i].descriptorCount = 1;
+      writes[i].descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+      writes[i].pBufferInfo = &infos[i];
+    }
+    device_dispatch[GetKey(device)].UpdateDescriptorSets(device, binding_count, writes.data(), 0, nullptr);
+    return set;
+  }
+  ~ComputePipeline(){
+    auto &dispatch = device_dispatch[GetKey(device)];
+    dispatch.DestroyDescriptorPool(device, pool, nullptr);
+    dispatch.DestroyPipeline(device, pipeline, nullptr);
+    dispatch.DestroyPipelineLayout(device, layout, nullptr);
+    dispatch.DestroyDescriptorSetLayout(device, set_layout, nullptr);
+    dispatch.DestroyShaderModule(device, shader, nullptr);
+  }
+};
+
 enum class ImageType : int{
   RENDER_TARGET_IMAGE,
   RENDER_COPY_IMAGE,
   DISPLAY_IMAGE,
+  DISPLAY_TARGET_IMAGE,
   IMAGE_TYPE_COUNT
 };
 std::ostream &operator<<( std::ostream &output, const ImageType &type ) {
@@ -453,9 +1360,124 @@ std::ostream &operator<<( std::ostream &output, const ImageType &type ) {
   case ImageType::DISPLAY_IMAGE:
     output << "Display Image";
     break;
+  case ImageType::DISPLAY_TARGET_IMAGE:
+    output << "Display Target Image";
+    break;
   }
   return output;
 }
+
+// The mapped staging images and buffers of the swapchains of a device, kept
+// after their swapchain is destroyed, so that the swapchain that replaces it
+// does not have to allocate and map them again. Applications recreate their
+// swapchain for every step of a window resize.
+//
+// The pool hands out resources that return to it when the last reference is
+// dropped. Images are only reused at the same size, buffers at up to twice
+// the size that is needed. Buffers of a swapchain that is created while the
+// window is resized get some headroom, so that the next swapchain fits into
+// them as well.
+class StagingPool : public std::enable_shared_from_this<StagingPool> {
+  struct BufferKey {
+    VkDevice device;
+    VkBufferUsageFlags usage;
+    ImageType type;
+  };
+  struct ImageKey {
+    VkDevice device;
+    VkExtent2D size;
+    VkImageTiling tiling;
+    VkImageUsageFlags usage;
+    VkFormat format;
+    ImageType type;
+  };
+  std::mutex lock;
+  bool open = true;
+  std::vector<std::pair<BufferKey, std::unique_ptr<FramebufferBuffer>>> buffers;
+  std::vector<std::pair<ImageKey, std::unique_ptr<FramebufferImage>>> images;
+
+  template<typename Key, typename Resource>
+  std::shared_ptr<Resource> lend(const Key &key, Resource *resource){
+    std::weak_ptr<StagingPool> pool = shared_from_this();
+    return std::shared_ptr<Resource>(resource, [pool, key](Resource *resource){
+	std::unique_ptr<Resource> owned{resource};
+	if(auto self = pool.lock()){
+	  self->giveBack(key, owned);
+	}
+      });
+  }
+  void giveBack(const BufferKey &key, std::unique_ptr<FramebufferBuffer> &buffer){
+    std::lock_guard<std::mutex> guard(lock);
+    if(open){
+      buffers.emplace_back(key, std::move(buffer));
+    }
+  }
+  void giveBack(const ImageKey &key, std::unique_ptr<FramebufferImage> &image){
+    std::lock_guard<std::mutex> guard(lock);
+    if(open){
+      images.emplace_back(key, std::move(image));
+    }
+  }
+public:
+  // What was left in the pool, to be released off the application's thread.
+  struct Leftovers {
+    std::vector<std::pair<BufferKey, std::unique_ptr<FramebufferBuffer>>> buffers;
+    std::vector<std::pair<ImageKey, std::unique_ptr<FramebufferImage>>> images;
+    bool empty() const { return buffers.empty() && images.empty(); }
+  };
+
+  // A buffer of at least `size` bytes, newly allocated with `capacity` bytes if there is none.
+  std::shared_ptr<FramebufferBuffer> buffer(VkDevice device, VkDeviceSize size, VkDeviceSize capacity, VkBufferUsageFlags usage, ImageType type, std::function<uint32_t(uint32_t memory_type_bits)> memoryTypeIndex){
+    const BufferKey key{device, usage, type};
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto best = buffers.end();
+      for(auto entry = buffers.begin(); entry != buffers.end(); entry++){
+	const auto &other = entry->first;
+	const VkDeviceSize available = entry->second->size;
+	if(other.device == device && other.usage == usage && other.type == type && available >= size && available <= size * 2
+	   && (best == buffers.end() || available < best->second->size)){
+	  best = entry;
+	}
+      }
+      if(best != buffers.end()){
+	auto buffer = std::move(best->second);
+	buffers.erase(best);
+	TRACE("Recycling buffer: " << buffer->size << " bytes");
+	return lend(key, buffer.release());
+      }
+    }
+    return lend(key, new FramebufferBuffer(device, capacity, usage, memoryTypeIndex));
+  }
+  std::shared_ptr<FramebufferImage> image(VkDevice device, VkExtent2D size, VkImageTiling tiling, VkImageUsageFlags usage, VkFormat format, ImageType type, std::function<uint32_t(uint32_t memory_type_bits)> memoryTypeIndex){
+    const ImageKey key{device, size, tiling, usage, format, type};
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      for(auto entry = images.begin(); entry != images.end(); entry++){
+	const auto &other = entry->first;
+	if(other.device == device && other.size.width == size.width && other.size.height == size.height
+	   && other.tiling == tiling && other.usage == usage && other.format == format && other.type == type){
+	  auto image = std::move(entry->second);
+	  images.erase(entry);
+	  TRACE("Recycling image: " << size.width << "x" << size.height);
+	  return lend(key, image.release());
+	}
+      }
+    }
+    return lend(key, new FramebufferImage(device, size, tiling, usage, format, memoryTypeIndex));
+  }
+  // Takes everything that is in the pool now. With `close` nothing is taken back any more.
+  Leftovers drain(bool close = false){
+    std::lock_guard<std::mutex> guard(lock);
+    Leftovers leftovers;
+    leftovers.buffers.swap(buffers);
+    leftovers.images.swap(images);
+    if(close){
+      open = false;
+    }
+    return leftovers;
+  }
+};
 struct PrimusSwapchain;
 struct ImageWorker {
   PrimusSwapchain &swapchain;
@@ -463,46 +1485,445 @@ struct ImageWorker {
   std::shared_ptr<FramebufferImage> render_image;
   std::shared_ptr<FramebufferImage> render_copy_image;
   std::shared_ptr<FramebufferImage> display_src_image;
-  Fence render_copy_fence;
+  std::shared_ptr<FramebufferBuffer> render_copy_buffer;
+  std::shared_ptr<FramebufferBuffer> display_src_buffer;
+  std::shared_ptr<HostBridge> host_bridge;
   Semaphore display_semaphore;
+  // the display image the current frame is uploaded to, see PrimusSwapchain::transfer
   VkImage display_image = VK_NULL_HANDLE;
-
-  std::shared_ptr<CommandBuffer> render_copy_command;
-  std::shared_ptr<CommandBuffer> display_command;
-  std::unique_ptr<Fence> display_command_fence;
+  // frames transferred from this image, to tell whether a display image still holds the last one
+  uint64_t transfers = 0;
+
+  // one of each per chunk of the frame
+  std::vector<std::shared_ptr<CommandBuffer>> render_copy_commands;
+  std::vector<Fence> render_copy_fences;
+  std::vector<std::shared_ptr<CommandBuffer>> display_commands;
+  std::vector<Fence> display_command_fences;
+  std::vector<bool> display_pending;
+  // whether a readback was submitted that nobody waited for yet
+  bool render_pending = false;
+  // the frame serial this image was last transferred for, 0 if it never was
+  uint64_t copied_serial = 0;
+  // whether the recorded readback only covers a part of the image
+  bool render_partial = false;
+  // hashes of the tiles of the frame that was last transferred to display_image
+  std::vector<uint64_t> tile_hashes;
+  bool tile_hashes_valid = false;
+  // PRIMUS_VK_DIRTY_TILES=gpu: the last transferred frame on the render GPU and the mask of changed tiles
+  std::shared_ptr<FramebufferBuffer> gpu_previous;
+  std::shared_ptr<FramebufferBuffer> tile_mask;
+  VkDescriptorSet tile_set = VK_NULL_HANDLE;
+  bool gpu_previous_valid = false;
+  bool render_forced = true;
+  // PRIMUS_VK_SCALE: the frame at the reduced size on both GPUs, and the size the readback was recorded for
+  std::shared_ptr<FramebufferImage> render_scaled_image;
+  std::shared_ptr<FramebufferImage> display_scaled_image;
+  VkExtent2D scaled_extent = {};
+  std::shared_ptr<TimestampQueries> timestamps;
+  // PRIMUS_VK_PACKING
+  VkDescriptorSet pack_set = VK_NULL_HANDLE;
+  VkDescriptorSet unpack_set = VK_NULL_HANDLE;
+  // whether render_copy_image is HOST_CACHED, otherwise the copy uses streaming loads
+  bool render_copy_cached = true;
+  // with ownership_transfer: hands render_image from the application's queue
+  // family to the transfer queue's and back, and whether it was handed over
+  std::shared_ptr<CommandBuffer> release_commands;
+  std::shared_ptr<CommandBuffer> reacquire_commands;
+  bool render_lent = false;
+  // orders the readback on transfer_queue after the rendering on the queue
+  // the application presents from
+  std::shared_ptr<Semaphore> handoff_semaphore;
 
   ImageWorker(PrimusSwapchain &swapchain, VkImage display_image, const VkSwapchainCreateInfoKHR &createInfo);
   ImageWorker(ImageWorker &&other) = default;
   ~ImageWorker();
   void initImages( const VkSwapchainCreateInfoKHR &createInfo);
   void createCommandBuffers();
-  void copyImageData(uint32_t idx, std::vector<VkSemaphore> sems);
+  void recordRenderCopy(const Damage &damage);
+  void recordBufferCopy(CommandBuffer &cmd, uint32_t chunk, VkImage srcImage, const std::vector<VkRect2D> &areas);
+  void recordDirtyTileCopy(CommandBuffer &cmd, uint32_t chunk);
+  void recordPackedCopy(CommandBuffer &cmd);
+  void recordUnpackedCopy(CommandBuffer &cmd, VkImageLayout displayLayout);
+  void recordDisplayCopy(uint32_t chunk, const std::vector<VkRect2D> &areas, bool open, bool close, bool preserve);
+  std::vector<VkRect2D> dirtyTiles(uint32_t chunk, const char *data, VkDeviceSize pitch);
+  std::vector<VkRect2D> maskedTiles(uint32_t chunk);
+  void addTileRun(std::vector<VkRect2D> &row_runs, uint32_t tx, uint32_t y0, uint32_t rows);
+  void copyImageData(uint32_t idx, VkSemaphore acquired, std::vector<VkSemaphore> sems, const Damage &damage, bool rebound);
+  void dropFrame();
 };
+// The memory type among those with `required` that the CPU copies frames
+// fastest with, -1 to leave the choice to the fixed preferences of
+// PrimusSwapchain::getImageMemory.
+int chooseMemoryType(VkDevice device, VkPhysicalDevice phy, const VkPhysicalDeviceMemoryProperties &props, MemoryAccess access, VkMemoryPropertyFlags required){
+  const char *env = getenv("PRIMUS_VK_MEMORY_PROBE");
+  if(env != nullptr && std::string{env} == "0"){
+    return -1;
+  }
+  uint32_t candidates = 0;
+  for(uint32_t i = 0; i < props.memoryTypeCount; i++){
+    if((props.memoryTypes[i].propertyFlags & required) == required){
+      candidates |= 1u << i;
+    }
+  }
+  if(__builtin_popcount(candidates) < 2){
+    return -1;
+  }
+  auto &dispatch = instance_dispatch[GetKey(phy)];
+  VkPhysicalDeviceProperties deviceProps;
+  dispatch.GetPhysicalDeviceProperties(phy, &deviceProps);
+  // per card, the memory types of two identical cards can perform differently, e.g. in different slots
+  const DeviceIdentity identity = deviceIdentity(phy, deviceProps, dispatch);
+  int memory_type = -1;
+  if(MemoryTypeCache::get().find(identity, access, memory_type) && (memory_type < 0 || (candidates & (1u << memory_type)) != 0)){
+    return memory_type;
+  }
+  double best_rate = 0;
+  memory_type = -1;
+  for(uint32_t i = 0; i < props.memoryTypeCount; i++){
+    if((candidates & (1u << i)) == 0){
+      continue;
+    }
+    const double rate = probeMemoryType(device, device_dispatch[GetKey(device)], props, i, access);
+    TRACE("Memory type " << i << " of " << deviceProps.deviceName << ": " << uint64_t(rate) / (1 << 20) << " MiB/s " << (access == MemoryAccess::READBACK ? "readback" : "upload"));
+    if(rate > best_rate){
+      best_rate = rate;
+      memory_type = i;
+    }
+  }
+  MemoryTypeCache::get().store(identity, access, memory_type);
+  return memory_type;
+}
+
+class CreateOtherDevice {
+public:
+  VkPhysicalDevice display_dev;
+  VkPhysicalDevice render_dev;
+  VkPhysicalDeviceMemoryProperties display_mem;
+  VkPhysicalDeviceMemoryProperties render_mem;
+  VkDevice render_gpu = VK_NULL_HANDLE;
+  // only valid after displayDevice() returned
+  VkDevice display_gpu = VK_NULL_HANDLE;
+  std::shared_future<void> display_created;
+  // both devices have VK_EXT_external_memory_host enabled
+  bool host_bridge = false;
+  VkDeviceSize host_pointer_alignment = 4096;
+  // whether present regions can be passed on to the display swapchain
+  bool display_incremental_present = false;
+  // the queues of both devices in queue_locks
+  std::vector<VkQueue> shared_queues;
+  // the layer's own readback queue on the render device, see addTransferQueue
+  VkQueue transfer_queue = VK_NULL_HANDLE;
+  uint32_t transfer_family = 0;
+  uint32_t transfer_index = 0;
+  std::vector<float> transfer_priorities;
+  // the memory types chosen by chooseMemoryType, the upload one is only valid after displayDevice() returned
+  std::shared_future<int> readback_probe;
+  int upload_type = -1;
+  // the staging resources of destroyed swapchains, on both devices
+  std::shared_ptr<StagingPool> staging = std::make_shared<StagingPool>();
+  // destroyed swapchains and unused staging resources that are being released
+  std::mutex retiring_lock;
+  std::vector<std::future<void>> retiring;
+
+  CreateOtherDevice(VkPhysicalDevice display_dev, VkPhysicalDevice render_dev):
+    display_dev(display_dev), render_dev(render_dev){
+  }
+  // Runs `release` on a thread of its own, freeing memory and destroying
+  // objects takes a while and the application is waiting for its new swapchain.
+  void retire(std::function<void()> release){
+    std::lock_guard<std::mutex> guard(retiring_lock);
+    retiring.erase(std::remove_if(retiring.begin(), retiring.end(), [](const std::future<void> &done){
+	  return done.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+	}), retiring.end());
+    retiring.push_back(std::async(std::launch::async, std::move(release)));
+  }
+  void awaitRetired(){
+    std::vector<std::future<void>> pending;
+    {
+      std::lock_guard<std::mutex> guard(retiring_lock);
+      pending.swap(retiring);
+    }
+    for(auto &release: pending){
+      release.wait();
+    }
+  }
+  // Extensions that are enabled on both devices on top of what they need otherwise.
+  std::vector<const char*> bridgeExtensions(VkPhysicalDevice phy){
+    std::vector<const char*> extensions;
+    if(host_bridge){
+      if(hasDeviceExtension(phy, VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME)){
+	extensions.push_back(VK_KHR_EXTERNAL_MEMORY_EXTENSION_NAME);
+      }
+      extensions.push_back(VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+    }
+    return extensions;
+  }
+  void shareQueue(VkQueue queue){
+    scoped_lock l(global_lock);
+    auto &mutex = queue_locks[queue];
+    if(!mutex){
+      mutex.reset(new std::mutex);
+      shared_queues.push_back(queue);
+    }
+  }
+  // Adds the layer's readback queue to the queues the application creates on
+  // the render device. It is created after the application's queues of its
+  // family, so the application never asks for it.
+  bool addTransferQueue(std::vector<VkDeviceQueueCreateInfo> &queueInfos){
+    if(!transferQueueSetting()){
+      return false;
+    }
+    auto &dispatch = instance_dispatch[GetKey(instance_info[GetKey(render_dev)].instance)];
+    uint32_t familyCount = 0;
+    dispatch.GetPhysicalDeviceQueueFamilyProperties(render_dev, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    dispatch.GetPhysicalDeviceQueueFamilyProperties(render_dev, &familyCount, families.data());
+
+    const VkQueueFlags needed = transferQueueFlags();
+    // graphics and compute queues can do transfers as well
+    const VkQueueFlags engines = VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT;
+    bool found = false;
+    uint32_t best_score = 0;
+    for(uint32_t i = 0; i < familyCount; i++){
+      const auto &family = families[i];
+      const bool capable = needed == VK_QUEUE_TRANSFER_BIT ? (family.queueFlags & (engines | VK_QUEUE_TRANSFER_BIT)) != 0 : (family.queueFlags & needed) != 0;
+      // damaged areas start anywhere
+      const bool granular = family.minImageTransferGranularity.width == 1 && family.minImageTransferGranularity.height == 1;
+      uint32_t used = 0;
+      for(const auto &info: queueInfos){
+	if(info.queueFamilyIndex == i){
+	  used += info.queueCount;
+	}
+      }
+      if(!capable || !granular || used >= family.queueCount){
+	continue;
+      }
+      const uint32_t score = ((family.queueFlags & VK_QUEUE_GRAPHICS_BIT) ? 2 : 0) + ((family.queueFlags & VK_QUEUE_COMPUTE_BIT) ? 1 : 0);
+      if(!found || score < best_score){
+	found = true;
+	best_score = score;
+	transfer_family = i;
+      }
+    }
+    if(!found){
+      TRACE("No queue family of the render GPU has a queue to spare, frames are read back on the application's queue.");
+      return false;
+    }
+
+    auto info = std::find_if(queueInfos.begin(), queueInfos.end(), [this](const VkDeviceQueueCreateInfo &info){
+	return info.queueFamilyIndex == transfer_family && info.flags == 0;
+      });
+    // the readback is on the critical path of every frame
+    const float priority = 1.0f;
+    if(info == queueInfos.end()){
+      transfer_priorities = {priority};
+      VkDeviceQueueCreateInfo queueInfo{.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
+      queueInfo.queueFamilyIndex = transfer_family;
+      queueInfo.queueCount = 1;
+      queueInfo.pQueuePriorities = transfer_priorities.data();
+      queueInfos.push_back(queueInfo);
+      transfer_index = 0;
+    }else{
+      transfer_priorities.assign(info->pQueuePriorities, info->pQueuePriorities + info->queueCount);
+      transfer_priorities.push_back(priority);
+      transfer_index = info->queueCount;
+      info->queueCount++;
+      info->pQueuePriorities = transfer_priorities.data();
+    }
+    TRACE("Reading frames back on queue " << transfer_index << " of family " << transfer_family);
+    return true;
+  }
+  void setRenderDevice(VkDevice render_gpu){
+    this->render_gpu = render_gpu;
+  }
+  void finish(std::function<VkResult(VkDeviceCreateInfo &createInfo, VkDevice &dev)> creator){
+    auto &minstance_info = instance_info[GetKey(render_dev)];
+    auto &minstance_dispatch = instance_dispatch[GetKey(minstance_info.instance)];
+    minstance_dispatch.GetPhysicalDeviceMemoryProperties(display_dev, &display_mem);
+    minstance_dispatch.GetPhysicalDeviceMemoryProperties(render_dev, &render_mem);
+
+    auto transport = transportSetting();
+    if(transport == "auto" || transport == "host"){
+      host_bridge = hasDeviceExtension(display_dev, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME)
+	&& hasDeviceExtension(render_dev, VK_EXT_EXTERNAL_MEMORY_HOST_EXTENSION_NAME);
+      if(!host_bridge){
+	TRACE("VK_EXT_external_memory_host is not supported by both devices, the host memory bridge is not available.");
+      }
+    }
+    // only set if the instance enabled Vulkan 1.1 or VK_KHR_get_physical_device_properties2,
+    // the default alignment is kept otherwise
+    if(host_bridge && minstance_dispatch.GetPhysicalDeviceProperties2 != nullptr){
+      for(auto phy: {display_dev, render_dev}){
+	VkPhysicalDeviceExternalMemoryHostPropertiesEXT hostProps {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_MEMORY_HOST_PROPERTIES_EXT};
+	VkPhysicalDeviceProperties2 props {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+	props.pNext = &hostProps;
+	minstance_dispatch.GetPhysicalDeviceProperties2(phy, &props);
+	host_pointer_alignment = std::max(host_pointer_alignment, hostProps.minImportedHostPointerAlignment);
+      }
+    }
+
+    // the display device is created while the application's device is, both take a while to
+    // initialize; CreateDevice waits for it before it returns
+    display_created = std::async(std::launch::async, [this, &minstance_info, creator](){
+	createDisplayDev(minstance_info, creator);
+	// the CPU's writes are not flushed
+	upload_type = chooseMemoryType(display_gpu, display_dev, display_mem, MemoryAccess::UPLOAD, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+      }).share();
+  }
+  void probeReadback(VkDevice device){
+    readback_probe = std::async(std::launch::async, [this, device](){
+	return chooseMemoryType(device, render_dev, render_mem, MemoryAccess::READBACK, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT);
+      }).share();
+  }
+  int readbackType(){
+    return readback_probe.valid() ? readback_probe.get() : -1;
+  }
+  // Waits for the display device to be created, throws if that failed.
+  VkDevice displayDevice(){
+    display_created.get();
+    return display_gpu;
+  }
+  void createDisplayDev(InstanceInfo &my_instance, std::function<VkResult(VkDeviceCreateInfo &createInfo, VkDevice &dev)> creator){
+    VkDeviceCreateInfo createInfo = {};
+    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+
+    VkDeviceQueueCreateInfo queueInfo{};
+    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+    queueInfo.queueFamilyIndex = my_instance.displayQueueFamilyIndex;
+    queueInfo.queueCount = 1;
+    const float defaultQueuePriority(0.0f);
+    queueInfo.pQueuePriorities = &defaultQueuePriority;
+
+    createInfo.queueCreateInfoCount = 1;
+    createInfo.pQueueCreateInfos = &queueInfo;
+    std::vector<const char*> extensions = bridgeExtensions(display_dev);
+    extensions.push_back(VK_KHR_SWAPCHAIN_EXTENSION_NAME);
+    display_incremental_present = hasDeviceExtension(display_dev, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+    if(display_incremental_present){
+      extensions.push_back(VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+    }
+    createInfo.enabledExtensionCount = extensions.size();
+    createInfo.ppEnabledExtensionNames = extensions.data();
+    VkResult ret = creator(createInfo, display_gpu);
+    TRACE("Creating display device finished!: " << ret);
+    if(ret != VK_SUCCESS){
+      throw std::runtime_error("Display device creation failed");
+    }
+  }
+};
+// The CreateOtherDevice of the render device `device`. The map is changed by
+// the creation and destruction of the instance's other devices.
+std::shared_ptr<CreateOtherDevice> otherDevice(InstanceInfo &instance, VkDevice device){
+  scoped_lock l(global_lock);
+  return instance.cod[GetKey(device)];
+}
+
+
 struct PrimusSwapchain{
   InstanceInfo &myInstance;
   std::chrono::steady_clock::time_point lastPresent = std::chrono::steady_clock::now();
   VkDevice device;
   VkQueue render_queue;
+  // the queue frames are read back on: the layer's own or render_queue, if the device has none to spare
+  VkQueue transfer_queue;
+  uint32_t transfer_family;
+  // the render images change hands between the families of render_queue and transfer_queue
+  bool ownership_transfer = false;
   VkDevice display_device;
   std::mutex displayQueueMutex;
   VkQueue display_queue;
   VkSwapchainKHR backend;
   std::vector<ImageWorker> images;
   VkExtent2D imgSize;
+  VkFormat format;
+  // replaces a swapchain of another size, so more are likely to follow
+  bool resizing = false;
+  TransportMode transport = TransportMode::IMAGE_COPY;
+  // for the buffer based transports
+  VkDeviceSize rowPitch = 0;
+  uint32_t chunk_count = 1;
+  uint32_t chunk_rows;
+  VkRect2D chunkArea(uint32_t chunk) const {
+    const uint32_t first = chunk * chunk_rows;
+    return VkRect2D{{0, int32_t(first)}, {imgSize.width, std::min(chunk_rows, imgSize.height - first)}};
+  }
+  // The parts of `damage` that fall into `chunk`.
+  std::vector<VkRect2D> chunkDamage(uint32_t chunk, const Damage &damage) const {
+    const VkRect2D area = chunkArea(chunk);
+    if(damage.empty()){
+      return {area};
+    }
+    std::vector<VkRect2D> areas;
+    for(const auto &rect: damage){
+      const VkRect2D clipped = intersectRect(rect, area);
+      if(clipped.extent.width != 0){
+	areas.push_back(clipped);
+      }
+    }
+    return areas;
+  }
+
+  // PRIMUS_VK_DIRTY_TILES
+  bool dirty_tiles = false;
+  bool gpu_dirty_tiles = false;
+  std::unique_ptr<ComputePipeline> dirty_tile_pipeline;
+  // the frame to compare, shared by all images since they are read back one after the other
+  std::shared_ptr<FramebufferBuffer> gpu_current;
+  // PRIMUS_VK_PACKING: the layout of the packed frame in the transfer buffers
+  PackingMode packing = PackingMode::NONE;
+  VkDeviceSize packedPitch = 0;
+  uint32_t packedRows = 0;
+  std::unique_ptr<ComputePipeline> pack_pipeline;
+  std::unique_ptr<ComputePipeline> unpack_pipeline;
+  // the unpacked frame on both GPUs, shared by all images like gpu_current
+  std::shared_ptr<FramebufferBuffer> pack_frame;
+  std::shared_ptr<FramebufferBuffer> unpack_frame;
+  void setupPacking(uint32_t image_count);
+  PackParams packParams() const {
+    const bool swap_rb = format == VK_FORMAT_B8G8R8A8_UNORM || format == VK_FORMAT_B8G8R8A8_SRGB;
+    return PackParams{uint32_t(packing), imgSize.width, imgSize.height, uint32_t(rowPitch / sizeof(uint32_t)), uint32_t(packedPitch / sizeof(uint32_t)), swap_rb};
+  }
+  // PRIMUS_VK_SCALE
+  bool scaling = false;
+  ScaleController scale;
+  VkExtent2D scaledSize(uint32_t steps) const {
+    return VkExtent2D{
+      std::max(1u, (imgSize.width * steps + SCALE_STEPS - 1) / SCALE_STEPS),
+      std::max(1u, (imgSize.height * steps + SCALE_STEPS - 1) / SCALE_STEPS)};
+  }
+  bool canScale(VkFormat format);
+  uint32_t tiles_x = 0, tiles_y = 0;
+  std::atomic<uint64_t> skipped_frames{0};
+  std::atomic<uint64_t> skipped_bytes{0};
+
+  // VK_KHR_incremental_present: the damage of the last frames, by frame serial
+  bool damage_tracking = false;
+  uint64_t frame_serial = 0;
+  std::deque<std::pair<uint64_t, Damage>> damage_history;
 
   VkSurfaceCapabilitiesKHR surfaceCapabilities = { };
 
-  std::vector<std::unique_ptr<std::thread>> threads;
 
   std::shared_ptr<CreateOtherDevice> cod;
   PrimusSwapchain(PrimusSwapchain &) = delete;
-  PrimusSwapchain(InstanceInfo &myInstance, VkDevice device, VkDevice display_device, VkSwapchainKHR backend, const VkSwapchainCreateInfoKHR *pCreateInfo, std::shared_ptr<CreateOtherDevice> &cod):
+  PrimusSwapchain(InstanceInfo &myInstance, VkDevice device, VkDevice display_device, VkSwapchainKHR backend, const VkSwapchainCreateInfoKHR *pCreateInfo, const PrimusSwapchain *old, std::shared_ptr<CreateOtherDevice> &cod):
     myInstance(myInstance), device(device), display_device(display_device), backend(backend), cod(cod){
     // TODO automatically find correct queue and not choose 0 forcibly
-    device_dispatch[GetKey(device)].GetDeviceQueue(device, 0, 0, &render_queue);
+    device_dispatch[GetKey(device)].GetDeviceQueue(device, myInstance.renderQueueFamilyIndex, 0, &render_queue);
     device_dispatch[GetKey(display_device)].GetDeviceQueue(display_device, myInstance.displayQueueFamilyIndex, 0, &display_queue);
     GetKey(render_queue) = GetKey(device); // TODO, use vkSetDeviceLoaderData instead
     GetKey(display_queue) = GetKey(display_device);
+    if(cod->transfer_queue != VK_NULL_HANDLE){
+      transfer_queue = cod->transfer_queue;
+      transfer_family = cod->transfer_family;
+    }else{
+      transfer_queue = render_queue;
+      transfer_family = myInstance.renderQueueFamilyIndex;
+    }
+    ownership_transfer = transfer_family != myInstance.renderQueueFamilyIndex;
+    cod->shareQueue(render_queue);
+    cod->shareQueue(transfer_queue);
+    cod->shareQueue(display_queue);
 
     instance_dispatch[GetKey(myInstance.instance)].GetPhysicalDeviceSurfaceCapabilitiesKHR(myInstance.display, pCreateInfo->surface, &surfaceCapabilities);
     TRACE("Min Images: " << surfaceCapabilities.minImageCount);
@@ -515,9 +1936,113 @@ struct PrimusSwapchain{
     device_dispatch[GetKey(display_device)].GetSwapchainImagesKHR(display_device, backend, &image_count, display_images.data());
 
     imgSize = pCreateInfo->imageExtent;
+    format = pCreateInfo->imageFormat;
+    resizing = old != nullptr && (old->imgSize.width != imgSize.width || old->imgSize.height != imgSize.height);
+
+    const auto texelSize = formatSize(pCreateInfo->imageFormat);
+    const auto transportRequest = transportSetting();
+    packing = texelSize != 0 ? choosePacking(packingSetting(), *pCreateInfo) : PackingMode::NONE;
+    if(texelSize != 0){
+      // the packed frame is written to the readback buffer, the host memory bridge has none
+      if(cod->host_bridge && (packing == PackingMode::NONE || transportRequest == "host")){
+	transport = TransportMode::HOST_BRIDGE;
+      }else if(transportRequest == "auto" || transportRequest == "buffer"){
+	transport = TransportMode::BUFFER_COPY;
+      }
+      // bufferRowLength is counted in texels, so the pitch needs to be a multiple of the texel size as well
+      const VkDeviceSize alignment = std::lcm(rowAlignment(), VkDeviceSize{texelSize});
+      rowPitch = (VkDeviceSize{imgSize.width} * texelSize + alignment - 1) / alignment * alignment;
+    }
+    const auto scaleRequest = texelSize != 0 ? scaleSetting() : std::string{};
+    if(scaleRequest == "auto"){
+      scale.configure(SCALE_STEPS, true, scaleBudget());
+      scaling = true;
+    }else if(!scaleRequest.empty()){
+      const long steps = std::lround(strtod(scaleRequest.c_str(), nullptr) * SCALE_STEPS);
+      scale.configure(std::max(1l, std::min<long>(SCALE_STEPS, steps)), false, 0);
+      scaling = scale.steps < SCALE_STEPS;
+    }
+    if(scaling && !canScale(format)){
+      TRACE("Format " << format << " can't be scaled, transferring at full size");
+      scaling = false;
+      scale.configure(SCALE_STEPS, false, 0);
+    }
+    if(packing != PackingMode::NONE){
+      if(transport != TransportMode::BUFFER_COPY || scaling){
+	TRACE("Packing " << packing << " needs the buffer transport and no scaling, transferring unpacked");
+	packing = PackingMode::NONE;
+      }else{
+	setupPacking(image_count);
+      }
+    }
+    // scaled and packed frames are transferred as a whole, they do not line up with chunks, damage or tiles
+    const bool whole = scaling || packing != PackingMode::NONE;
+    setChunkCount(transport == TransportMode::IMAGE_COPY || whole ? 1 : chunkSetting());
+    // the CPU copy of partial rows needs to know the size of a texel
+    damage_tracking = texelSize != 0 && !whole;
+    const auto dirtyTileRequest = whole ? std::string{} : dirtyTileSetting();
+    dirty_tiles = texelSize != 0 && (dirtyTileRequest == "1" || dirtyTileRequest == "cpu");
+    tiles_x = (imgSize.width + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    tiles_y = (imgSize.height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+    if(dirtyTileRequest == "gpu"){
+      // the shader writes the changed tiles into the readback buffer, which only the buffer transport has;
+      // it compares whole words, so rows need to start on one
+      if(transport == TransportMode::BUFFER_COPY && rowPitch % sizeof(uint32_t) == 0){
+	try {
+	  // current, previous, readback and mask
+	  dirty_tile_pipeline = std::unique_ptr<ComputePipeline>(new ComputePipeline(device, primus_vk_dirty_tiles_spv, sizeof(primus_vk_dirty_tiles_spv), 4, sizeof(DirtyTileParams), image_count));
+	  gpu_current = std::make_shared<FramebufferBuffer>(device, rowPitch * imgSize.height, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	    [this](uint32_t memoryTypeBits){ return getImageMemory(ImageType::RENDER_TARGET_IMAGE, memoryTypeBits); });
+	  gpu_dirty_tiles = true;
+	}catch(const std::exception &e){
+	  TRACE("Setting up the dirty tile shader failed (" << e.what() << "), hashing tiles on the CPU");
+	  dirty_tile_pipeline.reset();
+	}
+      }
+      dirty_tiles = !gpu_dirty_tiles;
+    }
+    try {
+      createImages(display_images, *pCreateInfo);
+    }catch(const std::exception &e){
+      if(transport == TransportMode::IMAGE_COPY){
+	throw;
+      }
+      TRACE("Setting up " << transport << " failed (" << e.what() << "), falling back to image copy");
+      images.clear();
+      transport = TransportMode::IMAGE_COPY;
+      setChunkCount(1);
+      packing = PackingMode::NONE;
+      if(gpu_dirty_tiles){
+	gpu_dirty_tiles = false;
+	dirty_tiles = true;
+      }
+      createImages(display_images, *pCreateInfo);
+    }
+    TRACE("Transport: " << transport << " in " << chunk_count << " chunks");
+    if(packing != PackingMode::NONE){
+      TRACE("Transport packing: " << packing << ", " << (packedPitch * packedRows >> 10) << " KiB per frame");
+    }
+    if(scaling){
+      TRACE("Transport scale: " << scale.steps << "/" << SCALE_STEPS << (scaleRequest == "auto" ? ", adaptive" : ""));
+    }
 
-    for(uint32_t i = 0; i < image_count; i++){
-      images.emplace_back(*this, display_images[i], *pCreateInfo);
+    TRACE("Using copy kernel: " << copyKernel().name << " with " << WorkPool::get().size() << " threads");
+    for(auto display_image: display_images){
+      display_targets.push_back(DisplayImage{display_image});
+      acquire_semaphores.emplace_back(display_device);
+    }
+    render_free.reset(new std::atomic<bool>[images.size()]);
+    frame_images.reset(new std::atomic<uint32_t>[images.size()]);
+    for(size_t i = 0; i < images.size(); i++){
+      render_free[i] = true;
+    }
+    mailbox = mailboxSetting();
+    if(mailbox){
+      TRACE("Mailbox: dropping frames that a newer one overtook");
+    }
+    pacer.configure(fpsLimitSetting(), pacingSetting());
+    if(pacer.enabled()){
+      TRACE("Pacing: " << (pacingSetting() ? "just in time" : "off") << ", frame rate limit " << fpsLimitSetting());
     }
 
     TRACE("Creating a Swapchain thread.");
@@ -526,117 +2051,168 @@ struct PrimusSwapchain{
     if(m_env == nullptr || std::string{m_env} != "1"){
       thread_count = image_count;
     }
-    threads.resize(thread_count);
-    for(auto &thread: threads){
-      thread = std::unique_ptr<std::thread>(new std::thread([this](){this->run();}));
-      pthread_setname_np(thread->native_handle(), "swapchain-thread");
-    }
+    startThreads(thread_count);
   }
 
   uint32_t getImageMemory(ImageType type, uint32_t memory_type_bits);
+  void createImages(const std::vector<VkImage> &display_images, const VkSwapchainCreateInfoKHR &createInfo);
+
+  void setChunkCount(uint32_t requested){
+    const uint32_t chunks = std::min(requested, std::max(1u, imgSize.height / CHUNK_MIN_ROWS));
+    chunk_rows = std::max(1u, (imgSize.height + chunks - 1) / chunks);
+    // so that no dirty tile straddles two chunks
+    chunk_rows = (chunk_rows + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE * DIRTY_TILE_SIZE;
+    chunk_count = (imgSize.height + chunk_rows - 1) / chunk_rows;
+  }
 
-  void storeImage(uint32_t index, VkQueue queue, std::vector<VkSemaphore> wait_on, Fence &notify);
+  void storeImage(uint32_t index, VkQueue queue, std::vector<VkSemaphore> wait_on);
+  Damage imageDamage(uint32_t index, const VkPresentInfoKHR *pPresentInfo, std::vector<VkRectLayerKHR> &regions);
 
   void queue(VkQueue queue, const VkPresentInfoKHR *pPresentInfo);
 
-  std::mutex queueMutex;
-  std::condition_variable has_work;
-  bool active = true;
+  static constexpr uint32_t NO_DISPLAY_IMAGE = UINT32_MAX;
   struct QueueItem {
     VkQueue queue;
     VkPresentInfoKHR pPresentInfo;
     uint32_t imgIndex;
+    // the position of the frame in the order it was queued
+    uint64_t serial = 0;
+    std::chrono::steady_clock::time_point queued_at = std::chrono::steady_clock::now();
+    // bound by the present thread, NO_DISPLAY_IMAGE if the display swapchain gave none
+    uint32_t displayIndex = NO_DISPLAY_IMAGE;
+    // what needs to be transferred to bring this image up to date
+    Damage damage;
+    // the application's present regions, passed on to the display swapchain
+    std::vector<VkRectLayerKHR> regions;
+  };
+  // A presented frame goes through two stages. A transfer thread waits for
+  // its readback, copies it and submits the upload. The present thread then
+  // presents the frames in the order they were queued. Frame n is handed to
+  // transfer thread n % stages.size(), so the present thread finds the next
+  // frame at the front of that thread's `transferred` ring, and every thread
+  // is only woken for its own work.
+  struct TransferStage {
+    SpscRing<QueueItem> queued;
+    // the display images of the queued frames, in the same order
+    SpscRing<uint32_t> bound;
+    SpscRing<QueueItem> transferred;
+    EventCount has_work;
+    std::unique_ptr<std::thread> thread;
+    TransferStage(size_t capacity): queued(capacity), bound(capacity), transferred(capacity){}
   };
-  std::list<QueueItem> work;
-  std::list<QueueItem> in_progress;
+  std::vector<std::unique_ptr<TransferStage>> stages;
+  std::unique_ptr<std::thread> present_thread;
+  // a frame was queued or transferred
+  EventCount present_work;
+  EventCount has_presented;
+  std::atomic<bool> active{true};
+  // frames queued but not presented yet
+  std::atomic<uint32_t> in_flight{0};
+  // written by queue() only
+  std::atomic<uint64_t> queued_frames{0};
+  // only used by the present thread
+  uint64_t presented_frames = 0;
+
+  // The application draws into `images` independently of the display
+  // swapchain. AcquireNextImage hands out any render image that is free, and
+  // the present thread acquires a display image for every queued frame, in
+  // the order they were queued, so the application never waits for the
+  // presentation engine of the display GPU.
+  struct DisplayImage {
+    VkImage image;
+    // the render image and its transfer this image was last uploaded from
+    size_t worker = SIZE_MAX;
+    uint64_t transfer = 0;
+  };
+  std::vector<DisplayImage> display_targets;
+  // signalled when the display image of frame n is ready, n % size; there are never more frames in flight
+  std::vector<Semaphore> acquire_semaphores;
+  // a render image is free once its frame was presented
+  std::unique_ptr<std::atomic<bool>[]> render_free;
+  EventCount has_free_image;
+  // where AcquireNextImage looks for a free render image first
+  uint32_t next_free = 0;
+  // VK_SUBOPTIMAL_KHR or the error the display swapchain last reported, returned to the application
+  std::atomic<VkResult> display_status{VK_SUCCESS};
+  // PRIMUS_VK_FPS and PRIMUS_VK_PACING
+  FramePacer pacer;
+  // what the recyclers of both devices had counted once the first and the
+  // last frame were presented; the recyclers are shared with other swapchains
+  // of the devices, e.g. the one that replaces this one, which set up before
+  RecyclerCounts objects_at_first;
+  RecyclerCounts objects_at_last;
+  // PRIMUS_VK_MAILBOX: the render image of frame n, n % size, to see whether it was read back
+  bool mailbox = false;
+  std::unique_ptr<std::atomic<uint32_t>[]> frame_images;
+  std::atomic<uint64_t> dropped_frames{0};
+  bool newerFrameReadBack(uint64_t serial);
+  // frames that may be in flight before AcquireNextImage waits; with mailbox the newest one wins anyway
+  size_t inFlightLimit() const {
+    return mailbox ? images.size() : images.size() - surfaceCapabilities.minImageCount;
+  }
+  void noteDisplayStatus(VkResult res);
+  bool takeRenderImage(std::chrono::steady_clock::time_point deadline, uint32_t &index);
+  void acquireDisplayImage(uint64_t serial);
+
+  void startThreads(size_t thread_count);
+  void transfer(TransferStage &stage);
   void present(const QueueItem &workItem);
-  void run();
+  void runPresent();
   void stop();
-  void waitForReady();
+  bool waitForReady(std::chrono::steady_clock::time_point deadline);
 };
 
-ImageWorker::ImageWorker(PrimusSwapchain &swapchain, VkImage display_image, const VkSwapchainCreateInfoKHR &createInfo): swapchain(swapchain), render_copy_fence(swapchain.device), display_semaphore(swapchain.display_device), display_image(display_image){
+ImageWorker::ImageWorker(PrimusSwapchain &swapchain, VkImage display_image, const VkSwapchainCreateInfoKHR &createInfo): swapchain(swapchain), display_semaphore(swapchain.display_device), display_image(display_image){
+  for(uint32_t i = 0; i < swapchain.chunk_count; i++){
+    render_copy_fences.emplace_back(swapchain.device);
+    display_command_fences.emplace_back(swapchain.display_device);
+  }
+  display_pending.resize(swapchain.chunk_count, false);
+  if(swapchain.dirty_tiles){
+    tile_hashes.resize(swapchain.tiles_x * swapchain.tiles_y);
+  }
   initImages(createInfo);
   createCommandBuffers();
 }
 ImageWorker::~ImageWorker(){
-  if(display_command_fence){
-    display_command_fence->await();
-  }
-}
-
-class CreateOtherDevice {
-public:
-  VkPhysicalDevice display_dev;
-  VkPhysicalDevice render_dev;
-  VkPhysicalDeviceMemoryProperties display_mem;
-  VkPhysicalDeviceMemoryProperties render_mem;
-  VkDevice render_gpu = VK_NULL_HANDLE;
-  VkDevice display_gpu = VK_NULL_HANDLE;
-
-  CreateOtherDevice(VkPhysicalDevice display_dev, VkPhysicalDevice render_dev):
-    display_dev(display_dev), render_dev(render_dev){
-  }
-  void setRenderDevice(VkDevice render_gpu){
-    this->render_gpu = render_gpu;
-  }
-  void finish(std::function<VkResult(VkDeviceCreateInfo &createInfo, VkDevice &dev)> creator){
-    auto &minstance_info = instance_info[GetKey(render_dev)];
-    auto &minstance_dispatch = instance_dispatch[GetKey(minstance_info.instance)];
-    minstance_dispatch.GetPhysicalDeviceMemoryProperties(display_dev, &display_mem);
-    minstance_dispatch.GetPhysicalDeviceMemoryProperties(render_dev, &render_mem);
-
-    createDisplayDev(minstance_info, creator);
+  // the fences go back to the recycler, which needs them idle
+  if(render_pending){
+    for(auto &fence: render_copy_fences){
+      fence.await();
+    }
   }
-  void createDisplayDev(InstanceInfo &my_instance, std::function<VkResult(VkDeviceCreateInfo &createInfo, VkDevice &dev)> creator){
-    VkDeviceCreateInfo createInfo = {};
-    createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-
-    VkDeviceQueueCreateInfo queueInfo{};
-    queueInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-    queueInfo.queueFamilyIndex = my_instance.displayQueueFamilyIndex;
-    queueInfo.queueCount = 1;
-    const float defaultQueuePriority(0.0f);
-    queueInfo.pQueuePriorities = &defaultQueuePriority;
-
-    createInfo.queueCreateInfoCount = 1;
-    createInfo.pQueueCreateInfos = &queueInfo;
-    createInfo.enabledExtensionCount = 1;
-    const char *swap[] = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-    createInfo.ppEnabledExtensionNames = swap;
-    VkResult ret = creator(createInfo, display_gpu);
-    TRACE("Creating display device finished!: " << ret);
-    if(ret != VK_SUCCESS){
-      throw std::runtime_error("Display device creation failed");
+  for(size_t i = 0; i < display_pending.size(); i++){
+    if(display_pending[i]){
+      display_command_fences[i].await();
     }
   }
-};
-
+}
 
 class CommandBuffer {
   VkCommandPool commandPool;
   VkDevice device;
+  uint32_t family;
+  // looked up once, commands are recorded for every frame
+  VkLayerDispatchTable &dispatch_table;
 public:
   VkCommandBuffer cmd;
-  CommandBuffer(VkDevice device, uint32_t queueFamilyIndex) : device(device) {
-    VkCommandPoolCreateInfo poolInfo = {.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
-    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
-    poolInfo.queueFamilyIndex = queueFamilyIndex;
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].CreateCommandPool(device, &poolInfo, nullptr, &commandPool));
-    VkCommandBufferAllocateInfo cmdBufAllocateInfo = {.sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
-    cmdBufAllocateInfo.commandPool = commandPool;
-    cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
-    cmdBufAllocateInfo.commandBufferCount = 1;
-
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].AllocateCommandBuffers(device, &cmdBufAllocateInfo, &cmd));
+  CommandBuffer(VkDevice device, uint32_t queueFamilyIndex) : device(device), family(queueFamilyIndex), dispatch_table(device_dispatch[GetKey(device)]) {
+    const auto buffer = recycler(device).commandBuffer(family);
+    commandPool = buffer.first;
+    cmd = buffer.second;
     GetKey(cmd) = GetKey(device);
 
     VkCommandBufferBeginInfo cmdBufInfo = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].BeginCommandBuffer(cmd, &cmdBufInfo));
+    VK_CHECK_RESULT(dispatch_table.BeginCommandBuffer(cmd, &cmdBufInfo));
+  }
+  // Drops the recorded commands and starts recording again.
+  void reset(){
+    VK_CHECK_RESULT(dispatch_table.ResetCommandBuffer(cmd, 0));
+    VkCommandBufferBeginInfo cmdBufInfo = {.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    VK_CHECK_RESULT(dispatch_table.BeginCommandBuffer(cmd, &cmdBufInfo));
   }
   ~CommandBuffer(){
-    device_dispatch[GetKey(device)].FreeCommandBuffers(device, commandPool, 1, &cmd);
-    device_dispatch[GetKey(device)].DestroyCommandPool(device, commandPool, nullptr);
+    recycler(device).give(family, {commandPool, cmd});
   }
   void insertImageMemoryBarrier(
 			      VkImage image,
@@ -655,7 +2231,7 @@ public:
     imageMemoryBarrier.image = image;
     imageMemoryBarrier.subresourceRange = subresourceRange;
 
-    device_dispatch[GetKey(device)].CmdPipelineBarrier(
+    dispatch_table.CmdPipelineBarrier(
 			 cmd,
 			 srcStageMask,
 			 dstStageMask,
@@ -664,40 +2240,192 @@ public:
 			 0, nullptr,
 			 1, &imageMemoryBarrier);
   }
-  void copyImage(VkImage src, VkImage dst, VkExtent2D imgSize){
-    VkImageCopy imageCopyRegion{};
-    imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.srcSubresource.layerCount = 1;
-    imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    imageCopyRegion.dstSubresource.layerCount = 1;
-    imageCopyRegion.extent.width = imgSize.width;
-    imageCopyRegion.extent.height = imgSize.height;
-    imageCopyRegion.extent.depth = 1;
+  // One half of a queue family ownership transfer of `image`, which stays in
+  // the present layout. The release and the acquire are recorded with the same
+  // families, on a queue of `srcFamily` and of `dstFamily` respectively.
+  void transferOwnership(VkImage image, uint32_t srcFamily, uint32_t dstFamily, bool release){
+    VkImageMemoryBarrier imageMemoryBarrier{.sType=VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    imageMemoryBarrier.srcAccessMask = release ? VK_ACCESS_MEMORY_WRITE_BIT : 0;
+    imageMemoryBarrier.dstAccessMask = release ? 0 : VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+    imageMemoryBarrier.oldLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageMemoryBarrier.newLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+    imageMemoryBarrier.srcQueueFamilyIndex = srcFamily;
+    imageMemoryBarrier.dstQueueFamilyIndex = dstFamily;
+    imageMemoryBarrier.image = image;
+    imageMemoryBarrier.subresourceRange = VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 };
+
+    dispatch_table.CmdPipelineBarrier(
+			 cmd,
+			 release ? VK_PIPELINE_STAGE_ALL_COMMANDS_BIT : VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+			 release ? VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT : VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+			 0,
+			 0, nullptr,
+			 0, nullptr,
+			 1, &imageMemoryBarrier);
+  }
+  // Scales all of `src` into `dst`, starting from the top left of both. The
+  // source is in the present layout and stays there, the destination's previous
+  // contents are discarded and it is left in the present layout as well.
+  void scaleImage(VkImage src, VkExtent2D srcExtent, VkImage dst, VkExtent2D dstExtent){
+    insertImageMemoryBarrier(
+	src,
+	VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
+	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    insertImageMemoryBarrier(
+	dst,
+	VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
+	VK_IMAGE_LAYOUT_UNDEFINED,		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    VkImageBlit region{};
+    region.srcSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.srcOffsets[1] = VkOffset3D{int32_t(srcExtent.width), int32_t(srcExtent.height), 1};
+    region.dstSubresource = VkImageSubresourceLayers{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+    region.dstOffsets[1] = VkOffset3D{int32_t(dstExtent.width), int32_t(dstExtent.height), 1};
+    dispatch_table.CmdBlitImage(
+	cmd,
+	src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	1, &region, VK_FILTER_LINEAR);
+    insertImageMemoryBarrier(
+	src,
+	VK_ACCESS_TRANSFER_READ_BIT,		VK_ACCESS_MEMORY_READ_BIT,
+	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    insertImageMemoryBarrier(
+	dst,
+	VK_ACCESS_TRANSFER_WRITE_BIT,		VK_ACCESS_MEMORY_READ_BIT,
+	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  }
+  void resetQueries(VkQueryPool pool, uint32_t first, uint32_t count){
+    dispatch_table.CmdResetQueryPool(cmd, pool, first, count);
+  }
+  void writeTimestamp(VkPipelineStageFlags stage, VkQueryPool pool, uint32_t query){
+    dispatch_table.CmdWriteTimestamp(cmd, stage, pool, query);
+  }
+  void copyImage(VkImage src, VkImage dst, const std::vector<VkRect2D> &areas){
+    if(areas.empty()){
+      return;
+    }
+    std::vector<VkImageCopy> regions;
+    for(const auto &area: areas){
+      VkImageCopy imageCopyRegion{};
+      imageCopyRegion.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      imageCopyRegion.srcSubresource.layerCount = 1;
+      imageCopyRegion.srcOffset = {area.offset.x, area.offset.y, 0};
+      imageCopyRegion.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      imageCopyRegion.dstSubresource.layerCount = 1;
+      imageCopyRegion.dstOffset = {area.offset.x, area.offset.y, 0};
+      imageCopyRegion.extent.width = area.extent.width;
+      imageCopyRegion.extent.height = area.extent.height;
+      imageCopyRegion.extent.depth = 1;
+      regions.push_back(imageCopyRegion);
+    }
 
     // Issue the copy command
-    device_dispatch[GetKey(device)].CmdCopyImage(
+    dispatch_table.CmdCopyImage(
+		   cmd,
+		   src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		   dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+		   regions.size(),
+		   regions.data());
+  }
+  void insertBufferMemoryBarrier(
+			      VkBuffer buffer,
+			      VkAccessFlags srcAccessMask,
+			      VkAccessFlags dstAccessMask,
+			      VkPipelineStageFlags srcStageMask,
+			      VkPipelineStageFlags dstStageMask,
+			      VkDeviceSize offset = 0,
+			      VkDeviceSize size = VK_WHOLE_SIZE) {
+    VkBufferMemoryBarrier bufferMemoryBarrier{.sType=VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    bufferMemoryBarrier.srcAccessMask = srcAccessMask;
+    bufferMemoryBarrier.dstAccessMask = dstAccessMask;
+    bufferMemoryBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferMemoryBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    bufferMemoryBarrier.buffer = buffer;
+    bufferMemoryBarrier.offset = offset;
+    bufferMemoryBarrier.size = size;
+
+    dispatch_table.CmdPipelineBarrier(
+			 cmd,
+			 srcStageMask,
+			 dstStageMask,
+			 0,
+			 0, nullptr,
+			 1, &bufferMemoryBarrier,
+			 0, nullptr);
+  }
+  void dispatch(VkPipeline pipeline, VkPipelineLayout layout, VkDescriptorSet set, const void *constants, uint32_t constantsSize, uint32_t x, uint32_t y){
+    auto &dispatch = dispatch_table;
+    dispatch.CmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+    dispatch.CmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, layout, 0, 1, &set, 0, nullptr);
+    dispatch.CmdPushConstants(cmd, layout, VK_SHADER_STAGE_COMPUTE_BIT, 0, constantsSize, constants);
+    dispatch.CmdDispatch(cmd, x, y, 1);
+  }
+  // Regions for copies between an image and a buffer holding the whole image, `rowPitch` bytes per row.
+  static std::vector<VkBufferImageCopy> bufferRegions(const std::vector<VkRect2D> &areas, VkDeviceSize rowPitch, uint32_t texelSize){
+    std::vector<VkBufferImageCopy> regions;
+    for(const auto &area: areas){
+      VkBufferImageCopy region{};
+      region.bufferOffset = area.offset.y * rowPitch + area.offset.x * texelSize;
+      region.bufferRowLength = rowPitch / texelSize;
+      region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+      region.imageSubresource.layerCount = 1;
+      region.imageOffset.x = area.offset.x;
+      region.imageOffset.y = area.offset.y;
+      region.imageExtent.width = area.extent.width;
+      region.imageExtent.height = area.extent.height;
+      region.imageExtent.depth = 1;
+      regions.push_back(region);
+    }
+    return regions;
+  }
+  void copyImageToBuffer(VkImage src, VkBuffer dst, const std::vector<VkRect2D> &areas, VkDeviceSize rowPitch, uint32_t texelSize){
+    if(areas.empty()){
+      return;
+    }
+    auto regions = bufferRegions(areas, rowPitch, texelSize);
+    dispatch_table.CmdCopyImageToBuffer(
 		   cmd,
 		   src, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+		   dst,
+		   regions.size(),
+		   regions.data());
+  }
+  void copyBufferToImage(VkBuffer src, VkImage dst, const std::vector<VkRect2D> &areas, VkDeviceSize rowPitch, uint32_t texelSize){
+    if(areas.empty()){
+      return;
+    }
+    auto regions = bufferRegions(areas, rowPitch, texelSize);
+    dispatch_table.CmdCopyBufferToImage(
+		   cmd,
+		   src,
 		   dst, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-		   1,
-		   &imageCopyRegion);
+		   regions.size(),
+		   regions.data());
   }
   void end(){
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].EndCommandBuffer(cmd));
+    VK_CHECK_RESULT(dispatch_table.EndCommandBuffer(cmd));
   }
-  void submit(VkQueue queue, VkFence fence, std::vector<VkSemaphore> wait = {}, std::vector<VkSemaphore> signal = {}){
+  void submit(VkQueue queue, VkFence fence, std::vector<VkSemaphore> wait = {}, std::vector<VkSemaphore> signal = {}, VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT){
     VkSubmitInfo submitInfo = {.sType=VK_STRUCTURE_TYPE_SUBMIT_INFO};
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &cmd;
-    VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
-    submitInfo.pWaitDstStageMask = &waitStage;
+    std::vector<VkPipelineStageFlags> waitStages(wait.size(), waitStage);
+    submitInfo.pWaitDstStageMask = waitStages.data();
     submitInfo.waitSemaphoreCount = wait.size();
     submitInfo.pWaitSemaphores = wait.data();
     submitInfo.signalSemaphoreCount = signal.size();
     submitInfo.pSignalSemaphores = signal.data();
 
     // Submit to the queue
-    VK_CHECK_RESULT(device_dispatch[GetKey(device)].QueueSubmit(queue, 1, &submitInfo, fence));
+    VK_CHECK_RESULT(dispatch_table.QueueSubmit(queue, 1, &submitInfo, fence));
   }
 };
 
@@ -711,29 +2439,112 @@ void ImageWorker::initImages( const VkSwapchainCreateInfoKHR &createInfo){
   renderImage = std::make_shared<FramebufferImage>(swapchain.device, imgSize,
     VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, format,
     [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_TARGET_IMAGE, memoryTypeBits); });
-  renderCopyImage = std::make_shared<FramebufferImage>(swapchain.device, imgSize,
-    VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_DST_BIT, format,
+  if(swapchain.scaling){
+    // full size, so that the scale can change without recreating them
+    render_scaled_image = std::make_shared<FramebufferImage>(swapchain.device, imgSize,
+      VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, format,
+      [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_TARGET_IMAGE, memoryTypeBits); });
+    display_scaled_image = std::make_shared<FramebufferImage>(swapchain.display_device, imgSize,
+      VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, format,
+      [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::DISPLAY_TARGET_IMAGE, memoryTypeBits); });
+    VkPhysicalDeviceProperties props;
+    instance_dispatch[GetKey(swapchain.myInstance.instance)].GetPhysicalDeviceProperties(swapchain.myInstance.render, &props);
+    uint32_t familyCount = 0;
+    instance_dispatch[GetKey(swapchain.myInstance.instance)].GetPhysicalDeviceQueueFamilyProperties(swapchain.myInstance.render, &familyCount, nullptr);
+    std::vector<VkQueueFamilyProperties> families(familyCount);
+    instance_dispatch[GetKey(swapchain.myInstance.instance)].GetPhysicalDeviceQueueFamilyProperties(swapchain.myInstance.render, &familyCount, families.data());
+    const uint32_t validBits = swapchain.transfer_family < familyCount ? families[swapchain.transfer_family].timestampValidBits : 0;
+    // without timestamps only the CPU side of the transfer is measured
+    if(validBits != 0){
+      timestamps = std::make_shared<TimestampQueries>(swapchain.device, props.limits.timestampPeriod, validBits);
+    }
+  }
+  const bool packed = swapchain.packing != PackingMode::NONE;
+  const VkDeviceSize bufferSize = packed ? swapchain.packedPitch * swapchain.packedRows : swapchain.rowPitch * imgSize.height;
+  if(swapchain.transport == TransportMode::HOST_BRIDGE){
+    host_bridge = std::make_shared<HostBridge>(swapchain.device, swapchain.cod->render_mem, swapchain.display_device, swapchain.cod->display_mem, bufferSize, swapchain.cod->host_pointer_alignment);
+    return;
+  }
+  if(swapchain.transport == TransportMode::BUFFER_COPY){
+    const VkDeviceSize capacity = swapchain.resizing ? bufferSize + bufferSize / 4 : bufferSize;
+    render_copy_buffer = swapchain.cod->staging->buffer(swapchain.device, bufferSize, capacity, VK_BUFFER_USAGE_TRANSFER_DST_BIT | (swapchain.gpu_dirty_tiles || packed ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0), ImageType::RENDER_COPY_IMAGE,
+      [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_COPY_IMAGE, memoryTypeBits); });
+    display_src_buffer = swapchain.cod->staging->buffer(swapchain.display_device, bufferSize, capacity, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | (packed ? VK_BUFFER_USAGE_STORAGE_BUFFER_BIT : 0), ImageType::DISPLAY_IMAGE,
+      [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::DISPLAY_IMAGE, memoryTypeBits); });
+    render_copy_buffer->map();
+    display_src_buffer->map();
+    render_copy_cached = (swapchain.cod->render_mem.memoryTypes[render_copy_buffer->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+    if(swapchain.gpu_dirty_tiles){
+      gpu_previous = std::make_shared<FramebufferBuffer>(swapchain.device, bufferSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	[this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_TARGET_IMAGE, memoryTypeBits); });
+      tile_mask = std::make_shared<FramebufferBuffer>(swapchain.device, VkDeviceSize{swapchain.tiles_x} * swapchain.tiles_y * sizeof(uint32_t), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+	[this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_COPY_IMAGE, memoryTypeBits); });
+      tile_mask->map();
+      tile_set = swapchain.dirty_tile_pipeline->allocateSet({swapchain.gpu_current->buf, gpu_previous->buf, render_copy_buffer->buf, tile_mask->buf});
+    }
+    if(packed){
+      pack_set = swapchain.pack_pipeline->allocateSet({swapchain.pack_frame->buf, render_copy_buffer->buf});
+      unpack_set = swapchain.unpack_pipeline->allocateSet({display_src_buffer->buf, swapchain.unpack_frame->buf});
+    }
+    return;
+  }
+  renderCopyImage = swapchain.cod->staging->image(swapchain.device, imgSize,
+    VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_DST_BIT, format, ImageType::RENDER_COPY_IMAGE,
     [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::RENDER_COPY_IMAGE, memoryTypeBits); });
-  displaySrcImage = std::make_shared<FramebufferImage>(swapchain.display_device, imgSize,
-    VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, format,
+  displaySrcImage = swapchain.cod->staging->image(swapchain.display_device, imgSize,
+    VK_IMAGE_TILING_LINEAR, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, format, ImageType::DISPLAY_IMAGE,
     [this](uint32_t memoryTypeBits){ return swapchain.getImageMemory(ImageType::DISPLAY_IMAGE, memoryTypeBits); });
 
   renderCopyImage->map();
   displaySrcImage->map();
+  render_copy_cached = (swapchain.cod->render_mem.memoryTypes[renderCopyImage->memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+  // displaySrcImage is transitioned to GENERAL together with those of the other images, see PrimusSwapchain::createImages
+}
 
-  CommandBuffer cmd{swapchain.display_device, swapchain.myInstance.displayQueueFamilyIndex};
-  cmd.insertImageMemoryBarrier(
-			       displaySrcImage->img,
-			       0,
-			       VK_ACCESS_MEMORY_WRITE_BIT,
-			       VK_IMAGE_LAYOUT_UNDEFINED,
-			       VK_IMAGE_LAYOUT_GENERAL,
-			       VK_PIPELINE_STAGE_TRANSFER_BIT,
-			       VK_PIPELINE_STAGE_TRANSFER_BIT,
-			       VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+// Creating the resources of an image takes a handful of allocations, mappings
+// and command pools on both GPUs, so the images are set up in parallel on the
+// copy pool. The layout transitions of all images are then recorded into one
+// command buffer, so that creating a swapchain waits for the display GPU once.
+void PrimusSwapchain::createImages(const std::vector<VkImage> &display_images, const VkSwapchainCreateInfoKHR &createInfo){
+  std::vector<std::optional<ImageWorker>> workers(display_images.size());
+  std::vector<std::exception_ptr> errors(display_images.size());
+  WorkPool::get().run(display_images.size(), [&](size_t i){
+    try {
+      workers[i].emplace(*this, display_images[i], createInfo);
+    }catch(...){
+      errors[i] = std::current_exception();
+    }
+  });
+  for(auto &error: errors){
+    if(error){
+      std::rethrow_exception(error);
+    }
+  }
+  images.reserve(workers.size());
+  for(auto &worker: workers){
+    images.push_back(std::move(*worker));
+  }
+  if(transport != TransportMode::IMAGE_COPY){
+    return;
+  }
+  CommandBuffer cmd{display_device, myInstance.displayQueueFamilyIndex};
+  for(auto &image: images){
+    cmd.insertImageMemoryBarrier(
+				 image.display_src_image->img,
+				 0,
+				 VK_ACCESS_MEMORY_WRITE_BIT,
+				 VK_IMAGE_LAYOUT_UNDEFINED,
+				 VK_IMAGE_LAYOUT_GENERAL,
+				 VK_PIPELINE_STAGE_TRANSFER_BIT,
+				 VK_PIPELINE_STAGE_TRANSFER_BIT,
+				 VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  }
   cmd.end();
-  Fence f{swapchain.display_device};
-  cmd.submit(swapchain.display_queue, f.fence);
+  Fence f{display_device};
+  {
+    auto lock = lockQueue(display_queue);
+    cmd.submit(display_queue, f.fence);
+  }
   f.await();
 }
 
@@ -781,12 +2592,36 @@ VkResult VKAPI_CALL PrimusVK_CreateDevice(
       device_instance_info[GetKey(dev)] = &my_instance_info;
       device_dispatch[GetKey(dev)] = fetchDispatchTable(gdpa, &dev);
     }
+    if(ret == VK_SUCCESS){
+      createMemoryArena(dev, my_instance_info.display);
+      createRecycler(dev);
+    }
     return ret;
   });
+  VkDeviceCreateInfo renderCreateInfo = *pCreateInfo;
+  std::vector<const char*> renderExtensions{pCreateInfo->ppEnabledExtensionNames, pCreateInfo->ppEnabledExtensionNames + pCreateInfo->enabledExtensionCount};
+  for(auto extension: cod->bridgeExtensions(physicalDevice)){
+    addExtension(renderExtensions, extension);
+  }
+  // VK_KHR_incremental_present is implemented by the layer, the render device never presents
+  if(!hasDeviceExtension(physicalDevice, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME)){
+    removeExtension(renderExtensions, VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME);
+  }
+  renderCreateInfo.enabledExtensionCount = renderExtensions.size();
+  renderCreateInfo.ppEnabledExtensionNames = renderExtensions.data();
+  std::vector<VkDeviceQueueCreateInfo> queueInfos{pCreateInfo->pQueueCreateInfos, pCreateInfo->pQueueCreateInfos + pCreateInfo->queueCreateInfoCount};
+  const bool transferQueue = cod->addTransferQueue(queueInfos);
+  renderCreateInfo.queueCreateInfoCount = queueInfos.size();
+  renderCreateInfo.pQueueCreateInfos = queueInfos.data();
   PFN_vkCreateDevice createFunc = (PFN_vkCreateDevice)gipa(VK_NULL_HANDLE, "vkCreateDevice");
-  VkResult ret = createFunc(physicalDevice, pCreateInfo, pAllocator, pDevice);
+  VkResult ret = createFunc(physicalDevice, &renderCreateInfo, pAllocator, pDevice);
+  // the loader's device creation must not run past the call that it belongs to
+  cod->display_created.wait();
   cod->setRenderDevice(*pDevice);
-  my_instance_info.cod[GetKey(*pDevice)] = cod;
+  {
+    scoped_lock l(global_lock);
+    my_instance_info.cod[GetKey(*pDevice)] = cod;
+  }
   if(ret != VK_SUCCESS){
     TRACE("Render Device creation failed: " << ret);
     return VK_ERROR_INITIALIZATION_FAILED;
@@ -797,6 +2632,13 @@ VkResult VKAPI_CALL PrimusVK_CreateDevice(
     device_instance_info[GetKey(*pDevice)] = &my_instance_info;
     device_dispatch[GetKey(*pDevice)] = fetchDispatchTable(gdpa, pDevice);
   }
+  createMemoryArena(*pDevice, physicalDevice);
+  createRecycler(*pDevice);
+  cod->probeReadback(*pDevice);
+  if(transferQueue){
+    device_dispatch[GetKey(*pDevice)].GetDeviceQueue(*pDevice, cod->transfer_family, cod->transfer_index, &cod->transfer_queue);
+    GetKey(cod->transfer_queue) = GetKey(*pDevice);
+  }
   TRACE("CreateDevice done");
 
   return ret;
@@ -823,6 +2665,11 @@ VkLayerDispatchTable fetchDispatchTable(PFN_vkGetDeviceProcAddr gdpa, VkDevice *
   FETCH(QueuePresentKHR);
 
   FETCH(CreateImage);
+  FETCH(CreateBuffer);
+  FETCH(DestroyBuffer);
+  FETCH(GetBufferMemoryRequirements);
+  FETCH(BindBufferMemory);
+  FETCH(GetMemoryHostPointerPropertiesEXT);
   FETCH(GetImageMemoryRequirements);
   FETCH(AllocateMemory);
   FETCH(BindImageMemory);
@@ -835,7 +2682,32 @@ VkLayerDispatchTable fetchDispatchTable(PFN_vkGetDeviceProcAddr gdpa, VkDevice *
 
   FETCH(AllocateCommandBuffers);
   FETCH(BeginCommandBuffer);
+  FETCH(ResetCommandBuffer);
   FETCH(CmdCopyImage);
+  FETCH(CmdCopyImageToBuffer);
+  FETCH(CmdCopyBufferToImage);
+  FETCH(CreateShaderModule);
+  FETCH(DestroyShaderModule);
+  FETCH(CreateDescriptorSetLayout);
+  FETCH(DestroyDescriptorSetLayout);
+  FETCH(CreatePipelineLayout);
+  FETCH(DestroyPipelineLayout);
+  FETCH(CreateComputePipelines);
+  FETCH(DestroyPipeline);
+  FETCH(CreateDescriptorPool);
+  FETCH(DestroyDescriptorPool);
+  FETCH(AllocateDescriptorSets);
+  FETCH(UpdateDescriptorSets);
+  FETCH(CmdBindPipeline);
+  FETCH(CmdBindDescriptorSets);
+  FETCH(CmdPushConstants);
+  FETCH(CmdDispatch);
+  FETCH(CmdBlitImage);
+  FETCH(CreateQueryPool);
+  FETCH(DestroyQueryPool);
+  FETCH(CmdResetQueryPool);
+  FETCH(CmdWriteTimestamp);
+  FETCH(GetQueryPoolResults);
   FETCH(CmdPipelineBarrier);
   FETCH(CreateCommandPool);
   //FETCH(CreateDevice);
@@ -866,16 +2738,34 @@ VkLayerDispatchTable fetchDispatchTable(PFN_vkGetDeviceProcAddr gdpa, VkDevice *
 
 void VKAPI_CALL PrimusVK_DestroyDevice(VkDevice device, const VkAllocationCallbacks* pAllocator)
 {
-  scoped_lock l(global_lock);
   auto &my_instance = *device_instance_info[GetKey(device)];
-  auto &display_device = my_instance.cod[GetKey(device)]->display_gpu;
+  auto cod = otherDevice(my_instance, device);
+  cod->readbackType();
+  cod->awaitRetired();
+  cod->staging->drain(true);
+  VkDevice display_device = VK_NULL_HANDLE;
+  try {
+    display_device = cod->displayDevice();
+  }catch(const std::exception &e){
+    TRACE("Display device was not created: " << e.what());
+  }
+  scoped_lock l(global_lock);
   auto device_key = GetKey(device);
-  auto display_device_key = GetKey(display_device);
-  my_instance.layerDestroyDevice(display_device, nullptr, device_dispatch[GetKey(display_device)].DestroyDevice);
+  if(display_device != VK_NULL_HANDLE){
+    memory_arenas.erase(display_device);
+    recyclers.erase(display_device);
+    auto display_device_key = GetKey(display_device);
+    my_instance.layerDestroyDevice(display_device, nullptr, device_dispatch[display_device_key].DestroyDevice);
+    device_dispatch.erase(display_device_key);
+  }
+  memory_arenas.erase(device);
+  recyclers.erase(device);
   device_dispatch[GetKey(device)].DestroyDevice(device, pAllocator);
+  for(auto queue: cod->shared_queues){
+    queue_locks.erase(queue);
+  }
   my_instance.cod.erase(device_key);
   device_dispatch.erase(device_key);
-  device_dispatch.erase(display_device_key);
 }
 
 VkResult VKAPI_CALL PrimusVK_CreateSwapchainKHR(VkDevice device, const VkSwapchainCreateInfoKHR* pCreateInfo, const VkAllocationCallbacks* pAllocator, VkSwapchainKHR* pSwapchain) {
@@ -887,16 +2777,21 @@ VkResult VKAPI_CALL PrimusVK_CreateSwapchainKHR(VkDevice device, const VkSwapcha
   info2.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
   pCreateInfo = &info2;
   
-  VkSwapchainKHR old = pCreateInfo->oldSwapchain;
-  if(old != VK_NULL_HANDLE){
-    PrimusSwapchain *ch = reinterpret_cast<PrimusSwapchain*>(old);
-    info2.oldSwapchain = ch->backend;
-    TRACE("Old Swapchain: " << ch->backend);
+  PrimusSwapchain *old = reinterpret_cast<PrimusSwapchain*>(pCreateInfo->oldSwapchain);
+  if(old != nullptr){
+    info2.oldSwapchain = old->backend;
+    TRACE("Old Swapchain: " << old->backend);
   }
   TRACE("Creating Swapchain for size: " << pCreateInfo->imageExtent.width << "x" << pCreateInfo->imageExtent.height);
   TRACE("MinImageCount: " << pCreateInfo->minImageCount);
   TRACE("fetching device for: " << GetKey(render_gpu));
-  VkDevice display_gpu = my_instance.cod[GetKey(device)]->display_gpu;
+  VkDevice display_gpu;
+  try {
+    display_gpu = otherDevice(my_instance, device)->displayDevice();
+  }catch(const std::exception &e){
+    TRACE("No display device: " << e.what());
+    return VK_ERROR_UNKNOWN;
+  }
 
   TRACE("FamilyIndexCount: " <<  pCreateInfo->queueFamilyIndexCount);
   TRACE("Dev: " << GetKey(display_gpu));
@@ -908,12 +2803,20 @@ VkResult VKAPI_CALL PrimusVK_CreateSwapchainKHR(VkDevice device, const VkSwapcha
   if(rc != VK_SUCCESS){
     return rc;
   }
+  auto cod = otherDevice(my_instance, device);
+  // so that the staging resources of swapchains that were just destroyed are back in the pool
+  cod->awaitRetired();
   try {
-    PrimusSwapchain *ch = new PrimusSwapchain(my_instance, render_gpu, display_gpu, backend, pCreateInfo, my_instance.cod[GetKey(device)]);
+    PrimusSwapchain *ch = new PrimusSwapchain(my_instance, render_gpu, display_gpu, backend, pCreateInfo, old, cod);
     *pSwapchain = reinterpret_cast<VkSwapchainKHR>(ch);
   }catch(const std::exception &e){
     return VK_ERROR_UNKNOWN;
   }
+  // what the new swapchain did not take was made for an older size
+  auto leftovers = std::make_shared<StagingPool::Leftovers>(cod->staging->drain());
+  if(!leftovers->empty()){
+    cod->retire([leftovers](){ leftovers->buffers.clear(); leftovers->images.clear(); });
+  }
 
 
 
@@ -926,7 +2829,8 @@ void VKAPI_CALL PrimusVK_DestroySwapchainKHR(VkDevice device, VkSwapchainKHR swa
   TRACE(">> Destroy swapchain: " << (void*) ch->backend);
   ch->stop();
   device_dispatch[GetKey(ch->display_device)].DestroySwapchainKHR(ch->display_device, ch->backend, pAllocator);
-  delete ch;
+  // the staging resources go back to the pool once the images are done with them
+  ch->cod->retire([ch](){ delete ch; });
 }
 VkResult VKAPI_CALL PrimusVK_GetSwapchainImagesKHR(VkDevice device, VkSwapchainKHR swapchain, uint32_t* pSwapchainImageCount, VkImage* pSwapchainImages) {
   PrimusSwapchain *ch = reinterpret_cast<PrimusSwapchain*>(swapchain);
@@ -948,23 +2852,35 @@ VkResult VKAPI_CALL PrimusVK_AcquireNextImage2KHR(VkDevice device, const VkAcqui
   TRACE_PROFILING_EVENT(-1, "Acquire starting");
   PrimusSwapchain *ch = reinterpret_cast<PrimusSwapchain*>(pAcquireInfo->swapchain);
 
-  auto timeout = pAcquireInfo->timeout;
-  VkResult res;
-  {
-    Fence myfence{ch->display_device};
-
-    ch->waitForReady();
-    res = device_dispatch[GetKey(ch->display_device)].AcquireNextImageKHR(ch->display_device, ch->backend, timeout, VK_NULL_HANDLE, myfence.fence, pImageIndex);
-    TRACE_PROFILING_EVENT(*pImageIndex, "got image");
-    myfence.await();
+  // the display swapchain is only acquired from by the present thread, but its state is passed on
+  const VkResult res = ch->display_status;
+  if(res < 0){
+    return res;
+  }
+  // UINT64_MAX and everything else that reaches past what the clock can hold waits forever
+  const auto now = std::chrono::steady_clock::now();
+  const auto forever = std::chrono::steady_clock::time_point::max();
+  const auto deadline = pAcquireInfo->timeout >= uint64_t(std::chrono::duration_cast<std::chrono::nanoseconds>(forever - now).count())
+    ? forever : now + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::nanoseconds(pAcquireInfo->timeout));
+  if(!ch->pacer.pace(deadline) || !ch->takeRenderImage(deadline, *pImageIndex)){
+    return pAcquireInfo->timeout == 0 ? VK_NOT_READY : VK_TIMEOUT;
   }
+  ch->pacer.acquired();
+  TRACE_PROFILING_EVENT(*pImageIndex, "got image");
   VkSubmitInfo qsi{};
   qsi.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
   if(pAcquireInfo->semaphore != VK_NULL_HANDLE){
     qsi.signalSemaphoreCount = 1;
     qsi.pSignalSemaphores = &pAcquireInfo->semaphore;
   }
-  scoped_lock lock(*device_instance_info[GetKey(ch->render_queue)]->renderQueueMutex);
+  auto &image = ch->images[*pImageIndex];
+  // the readback of the image's last frame has finished before it was free again
+  if(image.render_lent){
+    qsi.commandBufferCount = 1;
+    qsi.pCommandBuffers = &image.reacquire_commands->cmd;
+    image.render_lent = false;
+  }
+  auto lock = lockQueue(ch->render_queue);
   device_dispatch[GetKey(ch->render_queue)].QueueSubmit(ch->render_queue, 1, &qsi, pAcquireInfo->fence);
   TRACE_PROFILING_EVENT(*pImageIndex, "Acquire done");
 
@@ -989,6 +2905,8 @@ VkResult VKAPI_CALL PrimusVK_GetSwapchainStatusKHR(VkDevice device, VkSwapchainK
 uint32_t PrimusSwapchain::getImageMemory(ImageType image_type, uint32_t memoryTypeBits){
   const VkPhysicalDeviceMemoryProperties *mem_props = &cod->render_mem;
   std::vector<std::pair<VkMemoryPropertyFlags, VkMemoryPropertyFlags>> propertyPreferences;
+  // measured when the device was created, see chooseMemoryType
+  int probed = -1;
   switch(image_type){
   case ImageType::RENDER_TARGET_IMAGE:
     propertyPreferences = {
@@ -1002,14 +2920,26 @@ uint32_t PrimusSwapchain::getImageMemory(ImageType image_type, uint32_t memoryTy
       {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_CACHED_BIT, 0},
       {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, 0}
     };
+    probed = cod->readbackType();
     break;
   case ImageType::DISPLAY_IMAGE:
     mem_props = &cod->display_mem;
     propertyPreferences = {
       {VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, 0}
     };
+    probed = cod->upload_type;
+    break;
+  case ImageType::DISPLAY_TARGET_IMAGE:
+    mem_props = &cod->display_mem;
+    propertyPreferences = {
+      {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT},
+      {VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, 0}
+    };
     break;
   }
+  if(probed >= 0 && (memoryTypeBits & (1u << probed)) != 0){
+    return probed;
+  }
   for( const auto &requested : propertyPreferences ){
     for(size_t j = 0; j < mem_props->memoryTypeCount; j++){
       if( (memoryTypeBits & (1 << j)) == 0) {
@@ -1025,46 +2955,370 @@ uint32_t PrimusSwapchain::getImageMemory(ImageType image_type, uint32_t memoryTy
   throw std::runtime_error("No suitable image memory found.");
 }
 
+// Packed rows hold 4x2 texel blocks, so YUV420 rounds the luma plane up to an
+// even number of rows and adds half as many rows of chroma.
+void PrimusSwapchain::setupPacking(uint32_t image_count){
+  const VkDeviceSize blocks = (imgSize.width + 3) / 4;
+  switch(packing){
+  case PackingMode::RGB888:
+    packedPitch = blocks * 3 * sizeof(uint32_t);
+    packedRows = imgSize.height;
+    break;
+  case PackingMode::RGB565:
+    packedPitch = blocks * 2 * sizeof(uint32_t);
+    packedRows = imgSize.height;
+    break;
+  case PackingMode::YUV420:
+    packedPitch = blocks * sizeof(uint32_t);
+    packedRows = (imgSize.height + 1) / 2 * 3;
+    break;
+  case PackingMode::NONE:
+    return;
+  }
+  try {
+    // frame and packed frame
+    pack_pipeline = std::unique_ptr<ComputePipeline>(new ComputePipeline(device, primus_vk_pack_spv, sizeof(primus_vk_pack_spv), 2, sizeof(PackParams), image_count));
+    unpack_pipeline = std::unique_ptr<ComputePipeline>(new ComputePipeline(display_device, primus_vk_unpack_spv, sizeof(primus_vk_unpack_spv), 2, sizeof(PackParams), image_count));
+    pack_frame = std::make_shared<FramebufferBuffer>(device, rowPitch * imgSize.height, VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      [this](uint32_t memoryTypeBits){ return getImageMemory(ImageType::RENDER_TARGET_IMAGE, memoryTypeBits); });
+    unpack_frame = std::make_shared<FramebufferBuffer>(display_device, rowPitch * imgSize.height, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+      [this](uint32_t memoryTypeBits){ return getImageMemory(ImageType::DISPLAY_TARGET_IMAGE, memoryTypeBits); });
+  }catch(const std::exception &e){
+    TRACE("Setting up the packing shaders failed (" << e.what() << "), transferring unpacked");
+    pack_pipeline.reset();
+    unpack_pipeline.reset();
+    pack_frame.reset();
+    unpack_frame.reset();
+    packing = PackingMode::NONE;
+  }
+}
+
+// The render image is scaled down and the display image up with linear filtering.
+bool PrimusSwapchain::canScale(VkFormat format){
+  const VkFormatFeatureFlags needed = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+  for(auto phy: {myInstance.render, myInstance.display}){
+    VkFormatProperties props;
+    instance_dispatch[GetKey(myInstance.instance)].GetPhysicalDeviceFormatProperties(phy, format, &props);
+    if((props.optimalTilingFeatures & needed) != needed){
+      return false;
+    }
+  }
+  return true;
+}
+
 void ImageWorker::createCommandBuffers(){
-  {
-    auto cpyImage = render_copy_image;
-    auto srcImage = render_image->img;
-    render_copy_command = std::make_shared<CommandBuffer>(swapchain.device, swapchain.myInstance.renderQueueFamilyIndex);
-    CommandBuffer &cmd = *render_copy_command;
-    cmd.insertImageMemoryBarrier(
-	cpyImage->img,
-	VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
-	VK_IMAGE_LAYOUT_UNDEFINED,		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-	VK_PIPELINE_STAGE_HOST_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
-	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  for(uint32_t chunk = 0; chunk < swapchain.chunk_count; chunk++){
+    render_copy_commands.push_back(std::make_shared<CommandBuffer>(swapchain.device, swapchain.transfer_family));
+    display_commands.push_back(std::make_shared<CommandBuffer>(swapchain.display_device, swapchain.myInstance.displayQueueFamilyIndex));
+  }
+  if(swapchain.ownership_transfer){
+    const uint32_t app_family = swapchain.myInstance.renderQueueFamilyIndex;
+    release_commands = std::make_shared<CommandBuffer>(swapchain.device, app_family);
+    release_commands->transferOwnership(render_image->img, app_family, swapchain.transfer_family, true);
+    release_commands->end();
+    reacquire_commands = std::make_shared<CommandBuffer>(swapchain.device, app_family);
+    reacquire_commands->transferOwnership(render_image->img, swapchain.transfer_family, app_family, false);
+    reacquire_commands->end();
+  }
+  // also with transfer_queue == render_queue, the application may present from another queue
+  handoff_semaphore = std::make_shared<Semaphore>(swapchain.device);
+  recordRenderCopy({});
+}
+
+// With the buffer based transports the frame is split into chunks of rows.
+// Every chunk gets its own command buffers, so that a chunk can be copied by
+// the CPU and uploaded as soon as it is read back. The first chunk transitions
+// the images, the last one returns them to the present layout. All chunks of
+// a side go to the same queue, so the barriers recorded in the first chunk
+// also order the later submissions.
+//
+// A partial copy relies on the rest of the image still being up to date from
+// an earlier frame, so it has to keep the previous contents of the images.
+void ImageWorker::recordRenderCopy(const Damage &damage){
+  // a scaled frame is read back from the top left of render_scaled_image
+  auto srcImage = render_scaled_image ? render_scaled_image->img : render_image->img;
+  scaled_extent = swapchain.scaledSize(swapchain.scale.steps);
+  const uint32_t last = swapchain.chunk_count - 1;
+  for(uint32_t chunk = 0; chunk < swapchain.chunk_count; chunk++){
+    CommandBuffer &cmd = *render_copy_commands[chunk];
+    cmd.reset();
+    auto areas = swapchain.chunkDamage(chunk, damage);
+    if(swapchain.ownership_transfer && chunk == 0){
+      cmd.transferOwnership(render_image->img, swapchain.myInstance.renderQueueFamilyIndex, swapchain.transfer_family, false);
+    }
+    if(timestamps && chunk == 0){
+      cmd.resetQueries(timestamps->pool, 0, 2);
+      cmd.writeTimestamp(VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, timestamps->pool, 0);
+    }
+    if(render_scaled_image){
+      cmd.scaleImage(render_image->img, swapchain.imgSize, srcImage, scaled_extent);
+      areas = {VkRect2D{{0, 0}, scaled_extent}};
+    }
+    if(swapchain.transport == TransportMode::IMAGE_COPY){
+      auto cpyImage = render_copy_image;
+      cmd.insertImageMemoryBarrier(
+	  cpyImage->img,
+	  VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
+	  damage.empty() ? VK_IMAGE_LAYOUT_UNDEFINED : VK_IMAGE_LAYOUT_GENERAL,	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	  VK_PIPELINE_STAGE_HOST_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+      cmd.insertImageMemoryBarrier(
+	  srcImage,
+	  VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
+	  VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+
+      cmd.copyImage(srcImage, cpyImage->img, areas);
+
+      cmd.insertImageMemoryBarrier(
+	  cpyImage->img,
+	  VK_ACCESS_TRANSFER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
+	  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_GENERAL,
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_HOST_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+      cmd.insertImageMemoryBarrier(
+	  srcImage,
+	  VK_ACCESS_TRANSFER_READ_BIT,		VK_ACCESS_MEMORY_READ_BIT,
+	  VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    }else if(swapchain.packing != PackingMode::NONE){
+      recordPackedCopy(cmd);
+    }else if(swapchain.gpu_dirty_tiles && damage.empty()){
+      recordDirtyTileCopy(cmd, chunk);
+    }else{
+      recordBufferCopy(cmd, chunk, srcImage, areas);
+    }
+    if(timestamps && chunk == last){
+      cmd.writeTimestamp(VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, timestamps->pool, 1);
+    }
+    if(swapchain.ownership_transfer && chunk == last){
+      cmd.transferOwnership(render_image->img, swapchain.transfer_family, swapchain.myInstance.renderQueueFamilyIndex, true);
+    }
+    cmd.end();
+  }
+  render_partial = !damage.empty();
+  render_forced = !gpu_previous_valid;
+}
+
+void ImageWorker::recordBufferCopy(CommandBuffer &cmd, uint32_t chunk, VkImage srcImage, const std::vector<VkRect2D> &areas){
+  const uint32_t last = swapchain.chunk_count - 1;
+  auto dstBuffer = host_bridge ? host_bridge->render->buf : render_copy_buffer->buf;
+  const VkRect2D area = swapchain.chunkArea(chunk);
+  const VkDeviceSize offset = area.offset.y * swapchain.rowPitch;
+  const VkDeviceSize size = area.extent.height * swapchain.rowPitch;
+  cmd.insertBufferMemoryBarrier(
+      dstBuffer,
+      VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
+      offset, size);
+  if(chunk == 0){
     cmd.insertImageMemoryBarrier(
 	srcImage,
 	VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
 	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  }
+
+  cmd.copyImageToBuffer(srcImage, dstBuffer, areas, swapchain.rowPitch, formatSize(swapchain.format));
+
+  // make the chunk available to the host, and with the host memory bridge to the display GPU
+  cmd.insertBufferMemoryBarrier(
+      dstBuffer,
+      VK_ACCESS_TRANSFER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_HOST_BIT,
+      offset, size);
+  if(chunk == last){
+    cmd.insertImageMemoryBarrier(
+	srcImage,
+	VK_ACCESS_TRANSFER_READ_BIT,		VK_ACCESS_MEMORY_READ_BIT,
+	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 	VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  }
+}
+
+// PRIMUS_VK_PACKING: the frame is copied into the device local `pack_frame`
+// buffer, from where primus_vk_pack.comp packs it into the readback buffer.
+void ImageWorker::recordPackedCopy(CommandBuffer &cmd){
+  auto srcImage = render_image->img;
+  auto frame = swapchain.pack_frame->buf;
+  const PackParams params = swapchain.packParams();
+
+  // pack_frame is shared by all images, an earlier frame may still be packing it
+  cmd.insertBufferMemoryBarrier(
+      frame,
+      VK_ACCESS_SHADER_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT);
+  cmd.insertImageMemoryBarrier(
+      srcImage,
+      VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
+      VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+
+  cmd.copyImageToBuffer(srcImage, frame, {VkRect2D{{0, 0}, swapchain.imgSize}}, swapchain.rowPitch, formatSize(swapchain.format));
 
-    cmd.copyImage(srcImage, cpyImage->img, swapchain.imgSize);
+  cmd.insertImageMemoryBarrier(
+      srcImage,
+      VK_ACCESS_TRANSFER_READ_BIT,		VK_ACCESS_MEMORY_READ_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  cmd.insertBufferMemoryBarrier(
+      frame,
+      VK_ACCESS_TRANSFER_WRITE_BIT,	VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  cmd.insertBufferMemoryBarrier(
+      render_copy_buffer->buf,
+      VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  const auto &pipeline = *swapchain.pack_pipeline;
+  cmd.dispatch(pipeline.pipeline, pipeline.layout, pack_set, &params, sizeof(params), params.groupsX(), params.groupsY());
+
+  cmd.insertBufferMemoryBarrier(
+      render_copy_buffer->buf,
+      VK_ACCESS_SHADER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_HOST_BIT);
+}
 
+// PRIMUS_VK_DIRTY_TILES=gpu: the chunk is copied into the device local
+// `gpu_current` buffer and compared with `gpu_previous` there. The shader only
+// writes the changed tiles into the readback buffer and marks them in
+// `tile_mask`, so the unchanged ones are neither read back nor copied.
+void ImageWorker::recordDirtyTileCopy(CommandBuffer &cmd, uint32_t chunk){
+  auto srcImage = render_image->img;
+  auto current = swapchain.gpu_current->buf;
+  const uint32_t texelSize = formatSize(swapchain.format);
+  const VkRect2D area = swapchain.chunkArea(chunk);
+  const VkDeviceSize offset = area.offset.y * swapchain.rowPitch;
+  const VkDeviceSize size = area.extent.height * swapchain.rowPitch;
+  const uint32_t first_tile_row = area.offset.y / DIRTY_TILE_SIZE;
+  const uint32_t tile_rows = (area.extent.height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+  const VkDeviceSize maskOffset = VkDeviceSize{first_tile_row} * swapchain.tiles_x * sizeof(uint32_t);
+  const VkDeviceSize maskSize = VkDeviceSize{tile_rows} * swapchain.tiles_x * sizeof(uint32_t);
+
+  cmd.insertBufferMemoryBarrier(
+      render_copy_buffer->buf,
+      VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      offset, size);
+  cmd.insertBufferMemoryBarrier(
+      tile_mask->buf,
+      VK_ACCESS_HOST_READ_BIT,		VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      maskOffset, maskSize);
+  // gpu_current is shared by all images, an earlier frame may still be comparing it
+  cmd.insertBufferMemoryBarrier(
+      current,
+      VK_ACCESS_SHADER_READ_BIT,		VK_ACCESS_TRANSFER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+      offset, size);
+  if(chunk == 0){
     cmd.insertImageMemoryBarrier(
-	cpyImage->img,
-	VK_ACCESS_TRANSFER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
-	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_GENERAL,
-	VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_HOST_BIT,
+	srcImage,
+	VK_ACCESS_MEMORY_READ_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
+	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  }
+
+  cmd.copyImageToBuffer(srcImage, current, {area}, swapchain.rowPitch, texelSize);
+
+  cmd.insertBufferMemoryBarrier(
+      current,
+      VK_ACCESS_TRANSFER_WRITE_BIT,	VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      offset, size);
+  cmd.insertBufferMemoryBarrier(
+      gpu_previous->buf,
+      VK_ACCESS_SHADER_WRITE_BIT,		VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+      offset, size);
+
+  DirtyTileParams params;
+  params.first_tile_row = first_tile_row;
+  params.tiles_x = swapchain.tiles_x;
+  params.row_pitch = swapchain.rowPitch / sizeof(uint32_t);
+  params.row_size = (swapchain.imgSize.width * texelSize + sizeof(uint32_t) - 1) / sizeof(uint32_t);
+  params.tile_width = DIRTY_TILE_SIZE * texelSize / sizeof(uint32_t);
+  params.height = swapchain.imgSize.height;
+  params.force = gpu_previous_valid ? 0 : 1;
+  const auto &pipeline = *swapchain.dirty_tile_pipeline;
+  cmd.dispatch(pipeline.pipeline, pipeline.layout, tile_set, &params, sizeof(params), swapchain.tiles_x, tile_rows);
+
+  cmd.insertBufferMemoryBarrier(
+      render_copy_buffer->buf,
+      VK_ACCESS_SHADER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_HOST_BIT,
+      offset, size);
+  cmd.insertBufferMemoryBarrier(
+      tile_mask->buf,
+      VK_ACCESS_SHADER_WRITE_BIT,		VK_ACCESS_HOST_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_HOST_BIT,
+      maskOffset, maskSize);
+  if(chunk == swapchain.chunk_count - 1){
     cmd.insertImageMemoryBarrier(
 	srcImage,
 	VK_ACCESS_TRANSFER_READ_BIT,		VK_ACCESS_MEMORY_READ_BIT,
 	VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 	VK_PIPELINE_STAGE_TRANSFER_BIT,		VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-
-    cmd.end();
   }
+}
 
-  {
-    display_command = std::make_shared<CommandBuffer>(swapchain.display_device, swapchain.myInstance.displayQueueFamilyIndex);
-    CommandBuffer &cmd = *display_command;
+// PRIMUS_VK_PACKING: primus_vk_unpack.comp unpacks the uploaded frame into the
+// device local `unpack_frame` buffer, which is then copied into the display image.
+void ImageWorker::recordUnpackedCopy(CommandBuffer &cmd, VkImageLayout displayLayout){
+  auto frame = swapchain.unpack_frame->buf;
+  const PackParams params = swapchain.packParams();
+
+  cmd.insertBufferMemoryBarrier(
+      display_src_buffer->buf,
+      VK_ACCESS_HOST_WRITE_BIT,	VK_ACCESS_SHADER_READ_BIT,
+      VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+  // unpack_frame is shared by all images, an earlier frame may still be copying it
+  cmd.insertBufferMemoryBarrier(
+      frame,
+      VK_ACCESS_TRANSFER_READ_BIT,	VK_ACCESS_SHADER_WRITE_BIT,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT);
+
+  const auto &pipeline = *swapchain.unpack_pipeline;
+  cmd.dispatch(pipeline.pipeline, pipeline.layout, unpack_set, &params, sizeof(params), params.groupsX(), params.groupsY());
+
+  cmd.insertBufferMemoryBarrier(
+      frame,
+      VK_ACCESS_SHADER_WRITE_BIT,		VK_ACCESS_TRANSFER_READ_BIT,
+      VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT);
+  cmd.insertImageMemoryBarrier(
+      display_image,
+      VK_ACCESS_MEMORY_READ_BIT,	VK_ACCESS_TRANSFER_WRITE_BIT,
+      displayLayout,			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+  cmd.copyBufferToImage(frame, display_image, {VkRect2D{{0, 0}, swapchain.imgSize}}, swapchain.rowPitch, formatSize(swapchain.format));
+  cmd.insertImageMemoryBarrier(
+      display_image,
+      VK_ACCESS_TRANSFER_WRITE_BIT,	VK_ACCESS_MEMORY_READ_BIT,
+      VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+      VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+      VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+}
+
+// `open` transitions the display image for the copy and `close` returns it to
+// the present layout; they mark the first and last chunk that is submitted.
+// The display image is presented in between, so a partial copy needs to
+// `preserve` what is left of it.
+void ImageWorker::recordDisplayCopy(uint32_t chunk, const std::vector<VkRect2D> &areas, bool open, bool close, bool preserve){
+  CommandBuffer &cmd = *display_commands[chunk];
+  cmd.reset();
+  const VkImageLayout displayLayout = preserve ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_UNDEFINED;
+  // a scaled frame is uploaded to display_scaled_image and scaled up from there
+  VkImage target = display_scaled_image ? display_scaled_image->img : display_image;
+  if(swapchain.transport == TransportMode::IMAGE_COPY){
     cmd.insertImageMemoryBarrier(
 	display_src_image->img,
 	VK_ACCESS_HOST_WRITE_BIT,	VK_ACCESS_TRANSFER_READ_BIT,
@@ -1072,12 +3326,12 @@ void ImageWorker::createCommandBuffers(){
 	VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
     cmd.insertImageMemoryBarrier(
-	display_image,
+	target,
 	VK_ACCESS_MEMORY_READ_BIT,	VK_ACCESS_TRANSFER_WRITE_BIT,
-	VK_IMAGE_LAYOUT_UNDEFINED,	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	displayLayout,			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
 	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-    cmd.copyImage(display_src_image->img, display_image, swapchain.imgSize);
+    cmd.copyImage(display_src_image->img, target, areas);
 
     cmd.insertImageMemoryBarrier(
 	display_src_image->img,
@@ -1086,145 +3340,609 @@ void ImageWorker::createCommandBuffers(){
 	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_HOST_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
     cmd.insertImageMemoryBarrier(
-	display_image,
+	target,
 	VK_ACCESS_TRANSFER_WRITE_BIT,	VK_ACCESS_MEMORY_READ_BIT,
 	VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
 	VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
 	VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
-    cmd.end();
+  }else if(swapchain.packing != PackingMode::NONE){
+    recordUnpackedCopy(cmd, displayLayout);
+  }else{
+    auto srcBuffer = host_bridge ? host_bridge->display->buf : display_src_buffer->buf;
+    const VkRect2D area = swapchain.chunkArea(chunk);
+    cmd.insertBufferMemoryBarrier(
+	srcBuffer,
+	VK_ACCESS_HOST_WRITE_BIT,	VK_ACCESS_TRANSFER_READ_BIT,
+	VK_PIPELINE_STAGE_HOST_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	area.offset.y * swapchain.rowPitch, area.extent.height * swapchain.rowPitch);
+    if(open){
+      cmd.insertImageMemoryBarrier(
+	  target,
+	  VK_ACCESS_MEMORY_READ_BIT,	VK_ACCESS_TRANSFER_WRITE_BIT,
+	  displayLayout,			VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    }
+    cmd.copyBufferToImage(srcBuffer, target, areas, swapchain.rowPitch, formatSize(swapchain.format));
+    if(close){
+      cmd.insertImageMemoryBarrier(
+	  target,
+	  VK_ACCESS_TRANSFER_WRITE_BIT,	VK_ACCESS_MEMORY_READ_BIT,
+	  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,	VK_IMAGE_LAYOUT_PRESENT_SRC_KHR,
+	  VK_PIPELINE_STAGE_TRANSFER_BIT,	VK_PIPELINE_STAGE_TRANSFER_BIT,
+	  VkImageSubresourceRange{ VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 });
+    }
+  }
+  if(display_scaled_image && close){
+    cmd.scaleImage(target, scaled_extent, display_image, swapchain.imgSize);
+  }
+  cmd.end();
+}
+
+// The application renders on `queue`, the frame is read back on transfer_queue.
+void PrimusSwapchain::storeImage(uint32_t index, VkQueue queue, std::vector<VkSemaphore> wait_on){
+  auto &image = images[index];
+  if(image.host_bridge){
+    // the readback writes the memory that the upload of the image's last frame reads, and a
+    // render image is free again once its frame was presented, not once it was uploaded
+    for(size_t chunk = 0; chunk < image.display_pending.size(); chunk++){
+      if(image.display_pending[chunk]){
+	image.display_command_fences[chunk].await();
+      }
+    }
   }
+  if(ownership_transfer){
+    // hand the render image over once the application is done with it, AcquireNextImage takes it back
+    auto lock = lockQueue(queue);
+    image.release_commands->submit(queue, VK_NULL_HANDLE, wait_on, {image.handoff_semaphore->sem}, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+    wait_on = {image.handoff_semaphore->sem};
+    image.render_lent = true;
+  }else if(transfer_queue != queue && wait_on.empty()){
+    // without semaphores the rendering is only ordered on the application's queue
+    auto lock = lockQueue(queue);
+    VkSubmitInfo submitInfo = {.sType=VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.signalSemaphoreCount = 1;
+    submitInfo.pSignalSemaphores = &image.handoff_semaphore->sem;
+    VK_CHECK_RESULT(device_dispatch[GetKey(queue)].QueueSubmit(queue, 1, &submitInfo, VK_NULL_HANDLE));
+    wait_on = {image.handoff_semaphore->sem};
+  }
+  auto lock = lockQueue(transfer_queue);
+  for(uint32_t chunk = 0; chunk < chunk_count; chunk++){
+    // reset here rather than after the transfer, so that a frame's fences can be looked at until its image is queued again
+    image.render_copy_fences[chunk].reset();
+    // only the first chunk needs to wait for rendering, the others are queued behind it
+    image.render_copy_commands[chunk]->submit(transfer_queue, image.render_copy_fences[chunk].fence, chunk == 0 ? wait_on : std::vector<VkSemaphore>{}, {}, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT);
+  }
+  image.render_pending = true;
 }
 
-void PrimusSwapchain::storeImage(uint32_t index, VkQueue queue, std::vector<VkSemaphore> wait_on, Fence &notify){
-  images[index].render_copy_command->submit(queue, notify.fence, wait_on);
+// Bands are kept large enough to amortize the scheduling, but there are more
+// bands than threads so that idle threads can steal from slow ones.
+const size_t COPY_MIN_BAND_ROWS = 32;
+const size_t COPY_BANDS_PER_THREAD = 2;
+
+// Adds the tile in column `tx` to the runs of dirty tiles of one tile row.
+void ImageWorker::addTileRun(std::vector<VkRect2D> &row_runs, uint32_t tx, uint32_t y0, uint32_t rows){
+  const uint32_t x0 = tx * DIRTY_TILE_SIZE;
+  const uint32_t width = std::min(DIRTY_TILE_SIZE, swapchain.imgSize.width - x0);
+  if(!row_runs.empty() && row_runs.back().offset.x + row_runs.back().extent.width == x0){
+    row_runs.back().extent.width += width;
+  }else{
+    row_runs.push_back(VkRect2D{{int32_t(x0), int32_t(y0)}, {width, rows}});
+  }
 }
 
-void ImageWorker::copyImageData(uint32_t index, std::vector<VkSemaphore> sems){
-  {
-    auto rendered = render_copy_image->getMapped();
-    auto display = display_src_image->getMapped();
+// Hashes the tiles of `chunk` in the frame at `data` and returns the ones that
+// changed since the last frame transferred to this image, merged into
+// horizontal runs.
+std::vector<VkRect2D> ImageWorker::dirtyTiles(uint32_t chunk, const char *data, VkDeviceSize pitch){
+  const VkRect2D area = swapchain.chunkArea(chunk);
+  const uint32_t first_tile_row = area.offset.y / DIRTY_TILE_SIZE;
+  const uint32_t tile_rows = (area.extent.height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+  const size_t texelSize = formatSize(swapchain.format);
+  const HashFn hash = copyKernel().hash;
+  std::vector<std::vector<VkRect2D>> runs(tile_rows);
+  WorkPool::get().run(tile_rows, [&](size_t tile_row){
+    const uint32_t y0 = area.offset.y + tile_row * DIRTY_TILE_SIZE;
+    const uint32_t rows = std::min(DIRTY_TILE_SIZE, area.offset.y + area.extent.height - y0);
+    std::vector<uint64_t> hashes(swapchain.tiles_x, 0);
+    // row by row, so that the frame is read sequentially
+    for(uint32_t y = y0; y < y0 + rows; y++){
+      const char *row = data + y * pitch;
+      for(uint32_t tx = 0; tx < swapchain.tiles_x; tx++){
+	const uint32_t x0 = tx * DIRTY_TILE_SIZE;
+	const uint32_t width = std::min(DIRTY_TILE_SIZE, swapchain.imgSize.width - x0);
+	hashes[tx] = hash(hashes[tx], row + x0 * texelSize, width * texelSize);
+      }
+    }
+    auto &row_runs = runs[tile_row];
+    for(uint32_t tx = 0; tx < swapchain.tiles_x; tx++){
+      uint64_t &stored = tile_hashes[(first_tile_row + tile_row) * swapchain.tiles_x + tx];
+      const bool dirty = !tile_hashes_valid || stored != hashes[tx];
+      stored = hashes[tx];
+      if(!dirty){
+	continue;
+      }
+      addTileRun(row_runs, tx, y0, rows);
+    }
+  });
+  std::vector<VkRect2D> dirty;
+  for(const auto &row_runs: runs){
+    dirty.insert(dirty.end(), row_runs.begin(), row_runs.end());
+  }
+  return dirty;
+}
+
+// The changed tiles of a chunk as marked by primus_vk_dirty_tiles.comp.
+std::vector<VkRect2D> ImageWorker::maskedTiles(uint32_t chunk){
+  const VkRect2D area = swapchain.chunkArea(chunk);
+  const uint32_t first_tile_row = area.offset.y / DIRTY_TILE_SIZE;
+  const uint32_t tile_rows = (area.extent.height + DIRTY_TILE_SIZE - 1) / DIRTY_TILE_SIZE;
+  const uint32_t *mask = reinterpret_cast<const uint32_t*>(tile_mask->getMapped()->data);
+  std::vector<VkRect2D> dirty;
+  for(uint32_t tile_row = first_tile_row; tile_row < first_tile_row + tile_rows; tile_row++){
+    const uint32_t y0 = tile_row * DIRTY_TILE_SIZE;
+    const uint32_t rows = std::min(DIRTY_TILE_SIZE, area.offset.y + area.extent.height - y0);
+    std::vector<VkRect2D> row_runs;
+    for(uint32_t tx = 0; tx < swapchain.tiles_x; tx++){
+      if(mask[tile_row * swapchain.tiles_x + tx] != 0){
+	addTileRun(row_runs, tx, y0, rows);
+      }
+    }
+    dirty.insert(dirty.end(), row_runs.begin(), row_runs.end());
+  }
+  return dirty;
+}
+
+// The first submit waits for the display image to be `acquired`. When it was
+// `rebound`, it holds another frame than the last one of this image, and
+// everything that display_src holds is uploaded to it.
+void ImageWorker::copyImageData(uint32_t index, VkSemaphore acquired, std::vector<VkSemaphore> sems, const Damage &damage, bool rebound){
+  char *rendered_start = nullptr, *display_start = nullptr;
+  VkDeviceSize rendered_pitch = 0, display_pitch = 0;
+  VkMappedMemoryRange rendered_range{};
+  if(render_copy_buffer){
+    // both buffers were created with the same, tightly packed row pitch
+    rendered_start = render_copy_buffer->getMapped()->data;
+    display_start = display_src_buffer->getMapped()->data;
+    rendered_pitch = display_pitch = swapchain.packing != PackingMode::NONE ? swapchain.packedPitch : swapchain.rowPitch;
+    rendered_range = render_copy_buffer->mappedRange();
+  }else if(render_copy_image){
     auto rendered_layout = render_copy_image->getLayout();
     auto display_layout = display_src_image->getLayout();
-    auto rendered_start = rendered->data + rendered_layout.offset;
-    auto display_start = display->data + display_layout.offset;
+    rendered_start = render_copy_image->getMapped()->data + rendered_layout.offset;
+    display_start = display_src_image->getMapped()->data + display_layout.offset;
     if(rendered_layout.size/rendered_layout.rowPitch != display_layout.size/display_layout.rowPitch){
       TRACE("Layouts don't match at all");
       throw std::runtime_error("Layouts don't match at all");
     }
-    TRACE_PROFILING_EVENT(index, "memcpy start");
-    VkMappedMemoryRange rendered_range {
-      .sType = VK_STRUCTURE_TYPE_MAPPED_MEMORY_RANGE,
-      .pNext = VK_NULL_HANDLE,
-      .memory = render_copy_image->mem,
-      .offset = 0,
-      .size = VK_WHOLE_SIZE
-    };
-    VK_CHECK_RESULT(device_dispatch[GetKey(swapchain.device)].InvalidateMappedMemoryRanges(swapchain.device, 1, &rendered_range));
-    
-    if(rendered_layout.rowPitch == display_layout.rowPitch){
-      std::memcpy(display_start, rendered_start, rendered_layout.size);
+    rendered_pitch = rendered_layout.rowPitch;
+    display_pitch = display_layout.rowPitch;
+    rendered_range = render_copy_image->mappedRange();
+  }else{
+    // the host memory bridge is only hashed, the display GPU reads it directly
+    rendered_start = reinterpret_cast<char*>(host_bridge->host);
+    rendered_pitch = swapchain.rowPitch;
+    rendered_range = host_bridge->render->mappedRange();
+  }
+  const CopyKernel &kernel = copyKernel();
+  CopyFn copy = render_copy_cached ? kernel.copy : kernel.copy_uncached;
+  const VkDeviceSize minRowPitch = std::min(rendered_pitch, display_pitch);
+  const VkDeviceSize texelSize = formatSize(swapchain.format);
+  WorkPool &pool = WorkPool::get();
+  // tiles are only compared for full frames, the application's damage is used as it is
+  const bool hashing = swapchain.dirty_tiles && damage.empty();
+  const bool masked = swapchain.gpu_dirty_tiles && damage.empty();
+  const bool partial = hashing || masked || !damage.empty();
+  const bool preserve = !rebound && (!damage.empty() || (hashing && tile_hashes_valid) || (masked && !render_forced));
+  bool opened = false;
+  VkDeviceSize transferred = 0;
+
+  TRACE_PROFILING_EVENT(index, "memcpy start");
+  std::chrono::steady_clock::duration copy_time{0};
+  for(uint32_t chunk = 0; chunk < swapchain.chunk_count; chunk++){
+    render_copy_fences[chunk].await();
+    const auto copy_start = std::chrono::steady_clock::now();
+    if(rendered_range.memory != VK_NULL_HANDLE){
+      VK_CHECK_RESULT(device_dispatch[GetKey(swapchain.device)].InvalidateMappedMemoryRanges(swapchain.device, 1, &rendered_range));
+    }
+    std::vector<VkRect2D> areas;
+    if(swapchain.packing != PackingMode::NONE){
+      // the packed rows, they are full rows and so copied at the packed pitch
+      areas = {VkRect2D{{0, 0}, {swapchain.imgSize.width, swapchain.packedRows}}};
+    }else if(render_scaled_image){
+      areas = {VkRect2D{{0, 0}, scaled_extent}};
+    }else if(masked){
+      const VkMappedMemoryRange mask_range = tile_mask->mappedRange();
+      VK_CHECK_RESULT(device_dispatch[GetKey(swapchain.device)].InvalidateMappedMemoryRanges(swapchain.device, 1, &mask_range));
+      areas = maskedTiles(chunk);
+    }else if(hashing){
+      areas = dirtyTiles(chunk, rendered_start, rendered_pitch);
     }else{
-      VkDeviceSize display_offset = 0;
-      VkDeviceSize minRowPitch = rendered_layout.rowPitch;
-      if(display_layout.rowPitch < minRowPitch){
-	minRowPitch = display_layout.rowPitch;
+      areas = swapchain.chunkDamage(chunk, damage);
+    }
+    const bool last = chunk + 1 == swapchain.chunk_count;
+    if(display_pending[chunk]){
+      // the upload of this chunk from the last frame on this image still reads the buffer
+      display_command_fences[chunk].await();
+      display_command_fences[chunk].reset();
+      display_pending[chunk] = false;
+    }
+    if(display_start != nullptr){
+      for(const auto &area: areas){
+	// whole rows are copied including their padding, so that packed rows stay one block
+	const bool full_rows = area.extent.width == swapchain.imgSize.width;
+	const size_t row_offset = full_rows ? 0 : area.offset.x * texelSize;
+	const size_t row_size = full_rows ? minRowPitch : area.extent.width * texelSize;
+	const size_t first = area.offset.y;
+	const size_t count = area.extent.height;
+	// split the area into row bands that are copied in parallel on the shared pool
+	size_t bands = std::max<size_t>(1, std::min<size_t>(pool.size() * COPY_BANDS_PER_THREAD, (count + COPY_MIN_BAND_ROWS - 1) / COPY_MIN_BAND_ROWS));
+	const size_t band_rows = std::max<size_t>(1, (count + bands - 1) / bands);
+	bands = (count + band_rows - 1) / band_rows;
+	pool.run(bands, [&](size_t band){
+	  const size_t band_first = first + band * band_rows;
+	  const size_t band_count = std::min<size_t>(band_rows, first + count - band_first);
+	  copy(display_start + band_first * display_pitch + row_offset, display_pitch,
+	       rendered_start + band_first * rendered_pitch + row_offset, rendered_pitch,
+	       row_size, band_count);
+	});
       }
-      for(VkDeviceSize offset = 0; offset < rendered_layout.size; offset += rendered_layout.rowPitch){
-	std::memcpy(display_start + display_offset, rendered_start + offset, minRowPitch);
-	display_offset += display_layout.rowPitch;
+    }
+    copy_time += std::chrono::steady_clock::now() - copy_start;
+    for(const auto &area: areas){
+      transferred += VkDeviceSize{area.extent.width} * area.extent.height * texelSize;
+    }
+    // chunks without dirty tiles are skipped, unless they have to finish an upload started earlier
+    if(rebound || !(hashing || masked) || !areas.empty() || (last && opened)){
+      recordDisplayCopy(chunk, rebound && partial ? std::vector<VkRect2D>{swapchain.chunkArea(chunk)} : areas, !opened, last, preserve);
+      auto queue_lock = lockQueue(swapchain.display_queue);
+      display_commands[chunk]->submit(swapchain.display_queue, display_command_fences[chunk].fence,
+	!opened ? std::vector<VkSemaphore>{acquired} : std::vector<VkSemaphore>{}, last ? sems : std::vector<VkSemaphore>{}, VK_PIPELINE_STAGE_TRANSFER_BIT);
+      display_pending[chunk] = true;
+      opened = true;
+    }
+  }
+  render_pending = false;
+  if(!opened){
+    // nothing changed, the display image can be presented again as it is
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_ALL_COMMANDS_BIT;
+    VkSubmitInfo submitInfo = {.sType=VK_STRUCTURE_TYPE_SUBMIT_INFO};
+    submitInfo.waitSemaphoreCount = 1;
+    submitInfo.pWaitSemaphores = &acquired;
+    submitInfo.pWaitDstStageMask = &waitStage;
+    submitInfo.signalSemaphoreCount = sems.size();
+    submitInfo.pSignalSemaphores = sems.data();
+    auto queue_lock = lockQueue(swapchain.display_queue);
+    VK_CHECK_RESULT(device_dispatch[GetKey(swapchain.display_device)].QueueSubmit(swapchain.display_queue, 1, &submitInfo, VK_NULL_HANDLE));
+    swapchain.skipped_frames++;
+  }
+  if(hashing || masked){
+    const VkDeviceSize frameSize = VkDeviceSize{swapchain.imgSize.width} * swapchain.imgSize.height * texelSize;
+    swapchain.skipped_bytes += frameSize - std::min(transferred, frameSize);
+  }
+  tile_hashes_valid = hashing;
+  if(swapchain.scaling){
+    swapchain.scale.update(std::chrono::duration<double>(copy_time).count() + (timestamps ? timestamps->elapsed() : 0));
+  }
+  TRACE_PROFILING_EVENT(index, "memcpy done");
+}
+
+// The frame of this image could not be presented. Its readback is waited
+// for, and the next frame is transferred in full, since display_src missed
+// the changes of this one.
+void ImageWorker::dropFrame(){
+  for(auto &fence: render_copy_fences){
+    fence.await();
+  }
+  render_pending = false;
+  copied_serial = 0;
+  tile_hashes_valid = false;
+  gpu_previous_valid = false;
+}
+
+// Works out which part of image `index` needs to be transferred for this
+// present. The image still holds the frame it was last transferred for, so
+// it needs the damage of all frames presented since then. Anything that is
+// not covered by the recorded history is transferred in full.
+Damage PrimusSwapchain::imageDamage(uint32_t index, const VkPresentInfoKHR *pPresentInfo, std::vector<VkRectLayerKHR> &regions){
+  const VkPresentRegionsKHR *presentRegions = nullptr;
+  for(auto next = reinterpret_cast<const VkBaseInStructure*>(pPresentInfo->pNext); next != nullptr; next = next->pNext){
+    if(next->sType == VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR){
+      presentRegions = reinterpret_cast<const VkPresentRegionsKHR*>(next);
+    }
+  }
+  Damage frame;
+  // no rectangles means that the whole image changed
+  if(presentRegions != nullptr && presentRegions->pRegions != nullptr && presentRegions->pRegions[0].rectangleCount > 0){
+    const auto &region = presentRegions->pRegions[0];
+    regions.assign(region.pRectangles, region.pRectangles + region.rectangleCount);
+    const VkRect2D full{{0, 0}, imgSize};
+    for(const auto &rect: regions){
+      const VkRect2D clipped = intersectRect(VkRect2D{rect.offset, rect.extent}, full);
+      if(clipped.extent.width != 0){
+	frame.push_back(clipped);
       }
     }
-    TRACE_PROFILING_EVENT(index, "memcpy done");
+    limitDamage(frame);
   }
-  {
-    std::unique_lock<std::mutex> lock(swapchain.queueMutex);
-    if(display_command_fence){
-      display_command_fence->await();
-      display_command_fence->reset();
-    }else{
-      display_command_fence = std::unique_ptr<Fence>(new Fence(swapchain.display_device));
+
+  const uint64_t serial = ++frame_serial;
+  damage_history.emplace_back(serial, frame);
+  while(damage_history.size() > 2 * images.size()){
+    damage_history.pop_front();
+  }
+  auto &image = images[index];
+  const uint64_t since = image.copied_serial;
+  image.copied_serial = serial;
+  if(!damage_tracking || since == 0 || frame.empty() || damage_history.front().first > since + 1){
+    return {};
+  }
+  Damage damage;
+  for(const auto &entry: damage_history){
+    if(entry.first <= since){
+      continue;
     }
-    display_command->submit(swapchain.display_queue, display_command_fence->fence, {}, sems);
+    if(entry.second.empty()){
+      return {};
+    }
+    damage.insert(damage.end(), entry.second.begin(), entry.second.end());
   }
+  limitDamage(damage);
+  return damage;
 }
 
 void PrimusSwapchain::queue(VkQueue queue, const VkPresentInfoKHR* pPresentInfo){
-  std::unique_lock<std::mutex> lock(queueMutex);
-
   auto workItem = QueueItem{queue, *pPresentInfo, pPresentInfo->pImageIndices[0]};
-  storeImage(workItem.imgIndex, render_queue, std::vector<VkSemaphore>{pPresentInfo->pWaitSemaphores, pPresentInfo->pWaitSemaphores + pPresentInfo->waitSemaphoreCount}, images[workItem.imgIndex].render_copy_fence);
+  workItem.damage = imageDamage(workItem.imgIndex, pPresentInfo, workItem.regions);
+  auto &image = images[workItem.imgIndex];
+  // the dirty tile shader compares against everything once gpu_previous is filled
+  const bool forceChanged = gpu_dirty_tiles && image.render_forced == image.gpu_previous_valid;
+  const VkExtent2D scaled = scaledSize(scale.steps);
+  const bool scaleChanged = scaling && (scaled.width != image.scaled_extent.width || scaled.height != image.scaled_extent.height);
+  if(!workItem.damage.empty() || image.render_partial || forceChanged || scaleChanged){
+    image.recordRenderCopy(workItem.damage);
+  }
+  storeImage(workItem.imgIndex, render_queue, std::vector<VkSemaphore>{pPresentInfo->pWaitSemaphores, pPresentInfo->pWaitSemaphores + pPresentInfo->waitSemaphoreCount});
+  if(gpu_dirty_tiles){
+    // a copy of the application's damage bypasses the shader and leaves gpu_previous behind
+    image.gpu_previous_valid = workItem.damage.empty();
+  }
+
+  in_flight++;
+  workItem.serial = queued_frames;
+  frame_images[workItem.serial % images.size()] = workItem.imgIndex;
+  TransferStage &stage = *stages[workItem.serial % stages.size()];
+  // there are never more frames in flight than images, which the rings have room for
+  while(!stage.queued.push(std::move(workItem))){
+    std::this_thread::yield();
+  }
+  queued_frames++;
+  stage.has_work.notify();
+  present_work.notify();
+}
+
+bool PrimusSwapchain::waitForReady(std::chrono::steady_clock::time_point deadline) {
+  const size_t limit = inFlightLimit();
+  return has_presented.awaitUntil([this, limit](){ return in_flight <= limit; }, deadline);
+}
+
+// Takes a render image the application can draw into, false if there was
+// none by `deadline`.
+bool PrimusSwapchain::takeRenderImage(std::chrono::steady_clock::time_point deadline, uint32_t &index){
+  auto take = [this, &index](){
+    for(size_t i = 0; i < images.size(); i++){
+      const uint32_t candidate = (next_free + i) % images.size();
+      bool free = true;
+      if(render_free[candidate].compare_exchange_strong(free, false)){
+	index = candidate;
+	next_free = candidate + 1;
+	return true;
+      }
+    }
+    return false;
+  };
+  return waitForReady(deadline) && has_free_image.awaitUntil(take, deadline);
+}
+
+void PrimusSwapchain::noteDisplayStatus(VkResult res){
+  VkResult current = display_status;
+  // an error sticks, the application has to recreate the swapchain
+  while(current >= 0 && current != res && (res < 0 || res == VK_SUBOPTIMAL_KHR)
+	&& !display_status.compare_exchange_weak(current, res)){
+  }
+}
 
-  work.push_back(std::move(workItem));
-  has_work.notify_all();
+// Whether a frame queued after frame `serial` was read back already. The
+// readbacks run in order on transfer_queue, so the newest frame is enough.
+bool PrimusSwapchain::newerFrameReadBack(uint64_t serial){
+  const uint64_t newest = queued_frames - 1;
+  if(newest <= serial){
+    return false;
+  }
+  return images[frame_images[newest % images.size()]].render_copy_fences.back().signaled();
+}
+
+// Acquires the display image for frame `serial` and hands it to the frame's
+// transfer thread. The acquire is polled, so that stop() does not wait for
+// the presentation engine.
+void PrimusSwapchain::acquireDisplayImage(uint64_t serial){
+  const uint64_t DISPLAY_ACQUIRE_POLL = 100000000;
+  uint32_t displayIndex = NO_DISPLAY_IMAGE;
+  if(mailbox && newerFrameReadBack(serial)){
+    // dropped before it is copied, the newer frame takes its place
+    dropped_frames++;
+  }else{
+    VkResult res = VK_TIMEOUT;
+    const auto start = std::chrono::steady_clock::now();
+    while(active && display_status >= 0 && (res == VK_TIMEOUT || res == VK_NOT_READY)){
+      res = device_dispatch[GetKey(display_device)].AcquireNextImageKHR(display_device, backend, DISPLAY_ACQUIRE_POLL,
+	acquire_semaphores[serial % acquire_semaphores.size()].sem, VK_NULL_HANDLE, &displayIndex);
+    }
+    if(res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR){
+      TRACE("Acquiring a display image failed: " << res);
+      displayIndex = NO_DISPLAY_IMAGE;
+    }else{
+      pacer.displayAcquired(start);
+    }
+    noteDisplayStatus(res);
+  }
+  TransferStage &stage = *stages[serial % stages.size()];
+  while(!stage.bound.push(std::move(displayIndex))){
+    std::this_thread::yield();
+  }
+  stage.has_work.notify();
 }
 
-void PrimusSwapchain::waitForReady() {
-  std::unique_lock<std::mutex> lock(queueMutex);
-  has_work.wait(lock, [this](){return work.size() + in_progress.size()  <= images.size() - surfaceCapabilities.minImageCount;});
+void PrimusSwapchain::startThreads(size_t thread_count){
+  for(size_t i = 0; i < thread_count; i++){
+    stages.emplace_back(new TransferStage(images.size()));
+  }
+  for(auto &stage: stages){
+    TransferStage *own = stage.get();
+    stage->thread = std::unique_ptr<std::thread>(new std::thread([this, own](){this->transfer(*own);}));
+    pthread_setname_np(stage->thread->native_handle(), "swapchain-thread");
+  }
+  present_thread = std::unique_ptr<std::thread>(new std::thread([this](){this->runPresent();}));
+  pthread_setname_np(present_thread->native_handle(), "swapchain-present");
 }
 
 void PrimusSwapchain::stop(){
-  {
-    std::unique_lock<std::mutex> lock(queueMutex);
-    active = false;
-    has_work.notify_all();
+  active = false;
+  for(auto &stage: stages){
+    stage->has_work.notify();
+  }
+  present_work.notify();
+  for(auto &stage: stages){
+    stage->thread->join();
+    stage->thread.reset();
+  }
+  present_thread->join();
+  present_thread.reset();
+  if(in_flight != 0){
+    // frames were left between their acquire or upload and their present
+    for(auto &image: images){
+      image.display_semaphore.may_be_signaled = true;
+    }
+    for(auto &semaphore: acquire_semaphores){
+      semaphore.may_be_signaled = true;
+    }
   }
-  for(auto &thread: threads){
-    thread->join();
-    thread.reset();
+  if(presented_frames > 1){
+    const RecyclerCounts objects = objects_at_last - objects_at_first;
+    TRACE("Created " << objects.created << ", destroyed " << objects.destroyed << " and reused " << objects.reused
+	  << " fences, semaphores and command buffers while presenting " << presented_frames - 1 << " frames");
+  }
+  if(dirty_tiles){
+    TRACE("Dirty tiles: skipped " << skipped_frames << " frames and " << (skipped_bytes >> 20) << " MiB of transfers");
+  }
+  if(mailbox){
+    TRACE("Mailbox: dropped " << dropped_frames << " of " << queued_frames << " frames");
+  }
+  if(pacer.enabled()){
+    pacer.log();
   }
 }
-void PrimusSwapchain::present(const QueueItem &workItem){
+void PrimusSwapchain::transfer(TransferStage &stage){
+  QueueItem workItem;
+  while(true){
+    stage.has_work.await([this, &stage, &workItem](){ return !active || stage.queued.pop(workItem); });
+    if(!active) return;
+    const auto popped = std::chrono::steady_clock::now();
+    stage.has_work.await([this, &stage, &workItem](){ return !active || stage.bound.pop(workItem.displayIndex); });
+    if(!active) return;
+    // a wait for the display image is not part of the transfer, it is what the pacing avoids
+    const auto bound = std::chrono::steady_clock::now();
+    const auto start = bound - popped > std::chrono::milliseconds(1) ? bound : workItem.queued_at;
     const auto index = workItem.imgIndex;
-    images[index].render_copy_fence.await();
-    images[index].render_copy_fence.reset();
-    images[index].copyImageData(index, {images[index].display_semaphore.sem});
-
+    auto &image = images[index];
+    if(workItem.displayIndex == NO_DISPLAY_IMAGE){
+      image.dropFrame();
+    }else{
+      // the present thread hands the display images out one after the other, so no other thread uses this one
+      DisplayImage &target = display_targets[workItem.displayIndex];
+      const bool rebound = target.worker != index || target.transfer != image.transfers;
+      target.worker = index;
+      target.transfer = ++image.transfers;
+      image.display_image = target.image;
+      image.copyImageData(index, acquire_semaphores[workItem.serial % acquire_semaphores.size()].sem,
+	{image.display_semaphore.sem}, workItem.damage, rebound);
+    }
     TRACE_PROFILING_EVENT(index, "copy queued");
-
+    if(workItem.displayIndex != NO_DISPLAY_IMAGE){
+      pacer.transferred(std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count());
+    }
+    while(!stage.transferred.push(std::move(workItem))){
+      std::this_thread::yield();
+    }
+    present_work.notify();
+  }
+}
+void PrimusSwapchain::present(const QueueItem &workItem){
+    const auto index = workItem.displayIndex;
     VkPresentInfoKHR p2 = {.sType=VK_STRUCTURE_TYPE_PRESENT_INFO_KHR};
     p2.pSwapchains = &backend;
     p2.swapchainCount = 1;
     p2.pWaitSemaphores = &images[workItem.imgIndex].display_semaphore.sem;
     p2.waitSemaphoreCount = 1;
     p2.pImageIndices = &index;
+    VkPresentRegionKHR region{uint32_t(workItem.regions.size()), workItem.regions.data()};
+    VkPresentRegionsKHR regions{.sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR};
+    regions.swapchainCount = 1;
+    regions.pRegions = &region;
+    if(cod->display_incremental_present && !workItem.regions.empty()){
+      p2.pNext = &regions;
+    }
 
-    {
-      std::unique_lock<std::mutex> lock(queueMutex);
-      has_work.wait(lock, [this,&workItem](){return &workItem == &in_progress.front();});
-      TRACE_PROFILING_EVENT(index, "submitting");
-      VkResult res = device_dispatch[GetKey(display_device)].QueuePresentKHR(display_queue, &p2);
-      if(res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
-	TRACE("ERROR, Queue Present failed: " << res << "\n");
-      }
-      in_progress.pop_front();
-      has_work.notify_all();
+    TRACE_PROFILING_EVENT(index, "submitting");
+    auto queue_lock = lockQueue(display_queue);
+    VkResult res = device_dispatch[GetKey(display_device)].QueuePresentKHR(display_queue, &p2);
+    if(res != VK_SUCCESS && res != VK_SUBOPTIMAL_KHR) {
+      TRACE("ERROR, Queue Present failed: " << res << "\n");
     }
+    noteDisplayStatus(res);
 }
-void PrimusSwapchain::run(){
+void PrimusSwapchain::runPresent(){
+  QueueItem workItem;
+  // frames a display image was acquired for
+  uint64_t bound_frames = 0;
   while(true){
-    QueueItem *workItem = nullptr;
-    {
-      std::unique_lock<std::mutex> lock(queueMutex);
-      has_work.wait(lock, [this](){return !active || work.size() > 0;});
-      if(!active) return;
-      in_progress.push_back(std::move(work.front()));
-      workItem = &in_progress.back();
-      work.pop_front();
+    TransferStage &stage = *stages[presented_frames % stages.size()];
+    bool transferred = false;
+    // the display swapchain only guarantees an image while no more than images - minImageCount are held
+    present_work.await([this, &stage, &workItem, &transferred, &bound_frames](){
+      return !active || (transferred = stage.transferred.pop(workItem))
+	|| (bound_frames < queued_frames && bound_frames - presented_frames <= images.size() - surfaceCapabilities.minImageCount);
+    });
+    if(!active) return;
+    if(!transferred){
+      // ahead of the transfer, so that the upload of the frame can start once its readback is copied
+      acquireDisplayImage(bound_frames++);
+      continue;
+    }
+    if(workItem.displayIndex != NO_DISPLAY_IMAGE){
+      present(workItem);
+    }
+    objects_at_last = recyclerCounts(device) + recyclerCounts(display_device);
+    if(presented_frames == 0){
+      objects_at_first = objects_at_last;
     }
-    present(*workItem);
+    presented_frames++;
+    in_flight--;
+    has_presented.notify();
+    render_free[workItem.imgIndex] = true;
+    has_free_image.notify();
   }
 }
 
 VkResult VKAPI_CALL PrimusVK_QueueSubmit(VkQueue queue, uint32_t submitCount,
 							 const VkSubmitInfo* pSubmits,
 							 VkFence fence) {
-  scoped_lock lock(*device_instance_info[GetKey(queue)]->renderQueueMutex);
+  auto lock = lockQueue(queue);
   return device_dispatch[GetKey(queue)].QueueSubmit(queue, submitCount, pSubmits, fence);
 }
 
 VkResult VKAPI_CALL PrimusVK_QueuePresentKHR(VkQueue queue, const VkPresentInfoKHR* pPresentInfo) {
-  scoped_lock lock(*device_instance_info[GetKey(queue)]->renderQueueMutex);
   const auto start = std::chrono::steady_clock::now();
   if(pPresentInfo->swapchainCount != 1){
     TRACE("Warning, presenting with multiple swapchains not implemented, ignoring");
@@ -1235,10 +3953,11 @@ VkResult VKAPI_CALL PrimusVK_QueuePresentKHR(VkQueue queue, const VkPresentInfoK
   TRACE_PROFILING_EVENT(pPresentInfo->pImageIndices[0], "QueuePresent");
   TRACE_PROFILING(" === Time between VkQueuePresents: " << secs << " -> " << 1/secs << " FPS");
   ch->lastPresent = start;
+  ch->pacer.queued();
 
   ch->queue(queue, pPresentInfo);
 
-  return VK_SUCCESS;
+  return ch->display_status;
 }
 
 void VKAPI_CALL PrimusVK_GetPhysicalDeviceQueueFamilyProperties(VkPhysicalDevice physicalDevice, uint32_t* pQueueFamilyPropertyCount, VkQueueFamilyProperties* pQueueFamilyProperties) {
@@ -1288,15 +4007,19 @@ VkBool32 VKAPI_CALL PrimusVK_GetPhysicalDeviceWaylandPresentationSupportKHR(
 #endif
 
 void VKAPI_CALL PrimusVK_QueueWaitIdle(VkQueue queue){
-  scoped_lock lock(*device_instance_info[GetKey(queue)]->renderQueueMutex);
+  auto lock = lockQueue(queue);
   device_dispatch[GetKey(queue)].QueueWaitIdle(queue);
 }
 
 void VKAPI_CALL PrimusVK_DeviceWaitIdle(VkDevice device){
   auto &my_instance = *device_instance_info[GetKey(device)];
   device_dispatch[GetKey(device)].DeviceWaitIdle(device);
-  auto display_gpu = my_instance.cod[GetKey(device)]->display_gpu;
-  device_dispatch[GetKey(display_gpu)].DeviceWaitIdle(display_gpu);
+  try {
+    auto display_gpu = otherDevice(my_instance, device)->displayDevice();
+    device_dispatch[GetKey(display_gpu)].DeviceWaitIdle(display_gpu);
+  }catch(const std::exception &e){
+    // without a display device there is nothing to wait for
+  }
 }
 
 #include "primus_vk_forwarding_prototypes.h"
@@ -1337,10 +4060,27 @@ VkResult VKAPI_CALL PrimusVK_EnumerateInstanceExtensionProperties(
   return VK_SUCCESS;
 }
 
+// Device extensions implemented by the layer itself.
+const VkExtensionProperties layer_device_extensions[] = {
+  {VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME, VK_KHR_INCREMENTAL_PRESENT_SPEC_VERSION},
+};
+
+VkResult returnExtensions(const std::vector<VkExtensionProperties> &extensions, uint32_t *pPropertyCount, VkExtensionProperties *pProperties){
+  if(pProperties == nullptr){
+    *pPropertyCount = extensions.size();
+    return VK_SUCCESS;
+  }
+  const uint32_t count = std::min<size_t>(*pPropertyCount, extensions.size());
+  std::copy(extensions.begin(), extensions.begin() + count, pProperties);
+  *pPropertyCount = count;
+  return count < extensions.size() ? VK_INCOMPLETE : VK_SUCCESS;
+}
+
 VkResult VKAPI_CALL PrimusVK_EnumerateDeviceExtensionProperties(
                                      VkPhysicalDevice physicalDevice, const char *pLayerName,
                                      uint32_t *pPropertyCount, VkExtensionProperties *pProperties)
 {
+  const std::vector<VkExtensionProperties> layerExtensions{std::begin(layer_device_extensions), std::end(layer_device_extensions)};
   // pass through any queries that aren't to us
   if(pLayerName == NULL || strcmp(pLayerName, "VK_LAYER_PRIMUS_PrimusVK"))
   {
@@ -1350,12 +4090,28 @@ VkResult VKAPI_CALL PrimusVK_EnumerateDeviceExtensionProperties(
     }
 
     scoped_lock l(global_lock);
-    return instance_dispatch[GetKey(physicalDevice)].EnumerateDeviceExtensionProperties(physicalDevice, pLayerName, pPropertyCount, pProperties);
+    auto &dispatch = instance_dispatch[GetKey(physicalDevice)];
+    if(pLayerName != NULL){
+      return dispatch.EnumerateDeviceExtensionProperties(physicalDevice, pLayerName, pPropertyCount, pProperties);
+    }
+    // add our own extensions to the ones of the device
+    uint32_t count = 0;
+    VkResult res = dispatch.EnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, nullptr);
+    if(res != VK_SUCCESS){
+      return res;
+    }
+    std::vector<VkExtensionProperties> extensions(count);
+    dispatch.EnumerateDeviceExtensionProperties(physicalDevice, nullptr, &count, extensions.data());
+    extensions.resize(count);
+    for(const auto &layerExtension: layerExtensions){
+      if(std::none_of(extensions.begin(), extensions.end(), [&layerExtension](const VkExtensionProperties &extension){ return !strcmp(extension.extensionName, layerExtension.extensionName); })){
+	extensions.push_back(layerExtension);
+      }
+    }
+    return returnExtensions(extensions, pPropertyCount, pProperties);
   }
 
-  // don't expose any extensions
-  if(pPropertyCount) *pPropertyCount = 0;
-  return VK_SUCCESS;
+  return returnExtensions(layerExtensions, pPropertyCount, pProperties);
 }
 
 VkResult VKAPI_CALL PrimusVK_EnumeratePhysicalDevices(
@@ -1412,86 +4168,87 @@ VkResult VKAPI_CALL PrimusVK_GetRandROutputDisplayEXT(
 ///////////////////////////////////////////////////////////////////////////////////////////
 // GetProcAddr functions, entry points of the layer
 
-#define GETPROCADDR(func) if(!strcmp(pName, "vk" #func)) return (PFN_vkVoidFunction)&PrimusVK_##func;
+VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetDeviceProcAddr(VkDevice device, const char *pName);
+VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetInstanceProcAddr(VkInstance instance, const char *pName);
 
-VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetDeviceProcAddr(VkDevice device, const char *pName)
-{
-  // device chain functions we intercept
-  GETPROCADDR(GetDeviceProcAddr);
-  GETPROCADDR(EnumerateDeviceLayerProperties);
-  GETPROCADDR(EnumerateDeviceExtensionProperties);
-  GETPROCADDR(CreateDevice);
-  GETPROCADDR(DestroyDevice);
-
-  GETPROCADDR(CreateSwapchainKHR);
-  GETPROCADDR(DestroySwapchainKHR);
-  GETPROCADDR(GetSwapchainImagesKHR);
-  GETPROCADDR(AcquireNextImageKHR);
-  GETPROCADDR(AcquireNextImage2KHR);
-  GETPROCADDR(GetSwapchainStatusKHR);
-  GETPROCADDR(QueuePresentKHR);
-
-  GETPROCADDR(QueueSubmit);
-  GETPROCADDR(DeviceWaitIdle);
-  GETPROCADDR(QueueWaitIdle);
-  GETPROCADDR(GetRandROutputDisplayEXT);
-#define FORWARD(func) GETPROCADDR(func)
+#define ENTRY(func) visit("vk" #func, &PrimusVK_##func)
+
+// device chain functions we intercept
+constexpr auto device_entry_points = [](auto &&visit){
+  ENTRY(GetDeviceProcAddr);
+  ENTRY(EnumerateDeviceLayerProperties);
+  ENTRY(EnumerateDeviceExtensionProperties);
+  ENTRY(CreateDevice);
+  ENTRY(DestroyDevice);
+
+  ENTRY(CreateSwapchainKHR);
+  ENTRY(DestroySwapchainKHR);
+  ENTRY(GetSwapchainImagesKHR);
+  ENTRY(AcquireNextImageKHR);
+  ENTRY(AcquireNextImage2KHR);
+  ENTRY(GetSwapchainStatusKHR);
+  ENTRY(QueuePresentKHR);
+
+  ENTRY(QueueSubmit);
+  ENTRY(DeviceWaitIdle);
+  ENTRY(QueueWaitIdle);
+  ENTRY(GetRandROutputDisplayEXT);
+#define FORWARD(func) ENTRY(func)
   FORWARD(GetPhysicalDeviceSurfaceSupportKHR);
 #include "primus_vk_forwarding.h"
 #undef FORWARD
-  {
-    scoped_lock l(global_lock);
-    return device_dispatch[GetKey(device)].GetDeviceProcAddr(device, pName);
-  }
-}
+};
 
-VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetInstanceProcAddr(VkInstance instance, const char *pName)
-{
-  // instance chain functions we intercept
-  GETPROCADDR(GetInstanceProcAddr);
-  GETPROCADDR(EnumeratePhysicalDevices);
-  GETPROCADDR(EnumeratePhysicalDeviceGroups);
-  GETPROCADDR(EnumeratePhysicalDeviceGroupsKHR);
-  GETPROCADDR(EnumerateInstanceLayerProperties);
-  GETPROCADDR(EnumerateInstanceExtensionProperties);
-  GETPROCADDR(CreateInstance);
-  GETPROCADDR(DestroyInstance);
-
-  // device chain functions we intercept
-  GETPROCADDR(GetDeviceProcAddr);
-  GETPROCADDR(EnumerateDeviceLayerProperties);
-  GETPROCADDR(EnumerateDeviceExtensionProperties);
-  GETPROCADDR(CreateDevice);
-  GETPROCADDR(DestroyDevice);
-
-  GETPROCADDR(CreateSwapchainKHR);
-  GETPROCADDR(DestroySwapchainKHR);
-  GETPROCADDR(GetSwapchainImagesKHR);
-  GETPROCADDR(AcquireNextImageKHR);
-  GETPROCADDR(AcquireNextImage2KHR);
-  GETPROCADDR(GetSwapchainStatusKHR);
-  GETPROCADDR(QueuePresentKHR);
-
-  GETPROCADDR(QueueSubmit);
-  GETPROCADDR(DeviceWaitIdle);
-  GETPROCADDR(QueueWaitIdle);
-  GETPROCADDR(GetRandROutputDisplayEXT);
-  GETPROCADDR(GetPhysicalDeviceQueueFamilyProperties);
+// instance chain functions we intercept, the instance also hands out the device ones
+constexpr auto instance_entry_points = [](auto &&visit){
+  ENTRY(GetInstanceProcAddr);
+  ENTRY(EnumeratePhysicalDevices);
+  ENTRY(EnumeratePhysicalDeviceGroups);
+  ENTRY(EnumeratePhysicalDeviceGroupsKHR);
+  ENTRY(EnumerateInstanceLayerProperties);
+  ENTRY(EnumerateInstanceExtensionProperties);
+  ENTRY(CreateInstance);
+  ENTRY(DestroyInstance);
+
+  ENTRY(GetPhysicalDeviceQueueFamilyProperties);
 #ifdef VK_USE_PLATFORM_XCB_KHR
-  GETPROCADDR(GetPhysicalDeviceXcbPresentationSupportKHR);
+  ENTRY(GetPhysicalDeviceXcbPresentationSupportKHR);
 #endif
 #ifdef VK_USE_PLATFORM_XLIB_KHR
-  GETPROCADDR(GetPhysicalDeviceXlibPresentationSupportKHR);
+  ENTRY(GetPhysicalDeviceXlibPresentationSupportKHR);
 #endif
 #ifdef VK_USE_PLATFORM_WAYLAND_KHR
-  GETPROCADDR(GetPhysicalDeviceWaylandPresentationSupportKHR);
+  ENTRY(GetPhysicalDeviceWaylandPresentationSupportKHR);
 #endif
-#define FORWARD(func) GETPROCADDR(func)
-  FORWARD(GetPhysicalDeviceSurfaceSupportKHR);
-#include "primus_vk_forwarding.h"
-#undef FORWARD
-  {
-    scoped_lock l(global_lock);
-    return instance_dispatch[GetKey(instance)].GetInstanceProcAddr(instance, pName);
+  device_entry_points(visit);
+};
+
+#undef ENTRY
+
+constexpr size_t DEVICE_ENTRY_COUNT = countEntries(device_entry_points);
+constexpr NameTable<DEVICE_ENTRY_COUNT> device_entry_names(device_entry_points);
+const auto device_entry_functions = entryFunctions<PFN_vkVoidFunction, DEVICE_ENTRY_COUNT>(device_entry_points);
+
+constexpr size_t INSTANCE_ENTRY_COUNT = countEntries(instance_entry_points);
+constexpr NameTable<INSTANCE_ENTRY_COUNT> instance_entry_names(instance_entry_points);
+const auto instance_entry_functions = entryFunctions<PFN_vkVoidFunction, INSTANCE_ENTRY_COUNT>(instance_entry_points);
+
+// Everything we do not intercept is passed down the chain. The dispatch
+// registry is lock free for readers, so this does not take the global lock.
+VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetDeviceProcAddr(VkDevice device, const char *pName)
+{
+  const int index = device_entry_names.find(pName);
+  if(index >= 0){
+    return device_entry_functions[index];
+  }
+  return device_dispatch[GetKey(device)].GetDeviceProcAddr(device, pName);
+}
+
+VK_LAYER_EXPORT PFN_vkVoidFunction VKAPI_CALL PrimusVK_GetInstanceProcAddr(VkInstance instance, const char *pName)
+{
+  const int index = instance_entry_names.find(pName);
+  if(index >= 0){
+    return instance_entry_functions[index];
   }
+  return instance_dispatch[GetKey(instance)].GetInstanceProcAddr(instance, pName);
 }
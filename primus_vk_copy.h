@@ -0,0 +1,300 @@
+// Copy kernels for moving frame data from the render GPU's readback memory
+// into the display GPU's upload memory. The destination is usually
+// write-combined, so the SIMD variants bypass the cache with streaming stores.
+// The kernel is chosen once from CPUID and can be forced with
+// PRIMUS_VK_COPY_KERNEL=memcpy|sse2|avx2|avx512. Each kernel comes with a
+// matching hash function, which is used to find the parts of a frame that
+// did not change.
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define PRIMUS_VK_COPY_X86
+#include <immintrin.h>
+#endif
+
+// Copies `rows` rows of `row_size` bytes each, rows being `src_pitch` bytes
+// apart in the source and `dst_pitch` bytes apart in the destination.
+typedef void (*CopyFn)(char *dst, size_t dst_pitch, const char *src, size_t src_pitch, size_t row_size, size_t rows);
+// Hashes `size` bytes, continuing from the hash `seed` of the preceding data.
+// It only needs to notice changes between two frames, so speed matters more
+// than strength. All variants compute the same value.
+typedef uint64_t (*HashFn)(uint64_t seed, const char *data, size_t size);
+
+struct CopyKernel {
+  const char *name;
+  // for HOST_CACHED sources
+  CopyFn copy;
+  // for uncached sources, where streaming loads avoid the slow uncached reads
+  CopyFn copy_uncached;
+  HashFn hash;
+  bool (*supported)();
+};
+
+// How far ahead of the current read position the kernels prefetch.
+const size_t COPY_PREFETCH_DISTANCE = 512;
+
+static void copyRowMemcpy(char *dst, const char *src, size_t size){
+  std::memcpy(dst, src, size);
+}
+
+template<void (*row_copy)(char *, const char *, size_t), bool fence>
+static void copyRows(char *dst, size_t dst_pitch, const char *src, size_t src_pitch, size_t row_size, size_t rows){
+  if(rows == 0){
+    return;
+  }
+  if(dst_pitch == row_size && src_pitch == row_size){
+    // both sides are tightly packed, copy as one block
+    row_copy(dst, src, row_size * rows);
+  }else{
+    for(size_t y = 0; y < rows; y++){
+#ifdef PRIMUS_VK_COPY_X86
+      if(fence && y + 1 < rows){
+	// the in-row prefetch cannot see across the pitch gap, fetch the start of the next row explicitly
+	const char *next = src + (y + 1) * src_pitch;
+	for(size_t off = 0; off < COPY_PREFETCH_DISTANCE && off < row_size; off += 64){
+	  _mm_prefetch(next + off, _MM_HINT_NTA);
+	}
+      }
+#endif
+      row_copy(dst + y * dst_pitch, src + y * src_pitch, row_size);
+    }
+  }
+#ifdef PRIMUS_VK_COPY_X86
+  if(fence){
+    // streaming stores are weakly ordered, make them visible before the upload is submitted
+    _mm_sfence();
+  }
+#endif
+}
+
+static bool copyAlwaysSupported(){
+  return true;
+}
+
+// The hash keeps four 64 bit lanes. Every 32 byte block is keyed, and each
+// lane adds its input and the product of the two halves of its keyed input,
+// much like XXH3 does. The rotation makes the result depend on the order of
+// the blocks.
+static const uint64_t HASH_KEYS[4] = {0x9e3779b185ebca87ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0x85ebca77c2b2ae63ULL};
+const int HASH_ROTATE = 17;
+
+static inline uint64_t hashMix(uint64_t h){
+  h ^= h >> 33;
+  h *= 0xff51afd7ed558ccdULL;
+  h ^= h >> 33;
+  h *= 0xc4ceb9fe1a85ec53ULL;
+  h ^= h >> 33;
+  return h;
+}
+static inline uint64_t hashLane(uint64_t acc, uint64_t data, uint64_t key){
+  const uint64_t keyed = data ^ key;
+  return ((acc << HASH_ROTATE) | (acc >> (64 - HASH_ROTATE))) + data + (keyed & 0xffffffff) * (keyed >> 32);
+}
+// Folds the lanes and whatever is left of the data into the final value.
+static uint64_t hashFinish(uint64_t acc[4], const char *data, size_t size, size_t total){
+  uint64_t h = hashMix(acc[0]) ^ hashMix(acc[1] + 1) ^ hashMix(acc[2] + 2) ^ hashMix(acc[3] + 3) ^ total;
+  for(; size >= 8; size -= 8, data += 8){
+    uint64_t word;
+    std::memcpy(&word, data, 8);
+    h = hashMix(h ^ word);
+  }
+  if(size > 0){
+    uint64_t word = 0;
+    std::memcpy(&word, data, size);
+    h = hashMix(h ^ word);
+  }
+  return h;
+}
+static uint64_t hashScalar(uint64_t seed, const char *data, size_t size){
+  const size_t total = size;
+  uint64_t acc[4] = {seed, seed, seed, seed};
+  for(; size >= 32; size -= 32, data += 32){
+    for(int i = 0; i < 4; i++){
+      uint64_t word;
+      std::memcpy(&word, data + 8 * i, 8);
+      acc[i] = hashLane(acc[i], word, HASH_KEYS[i]);
+    }
+  }
+  return hashFinish(acc, data, size, total);
+}
+
+#ifdef PRIMUS_VK_COPY_X86
+// Copies the unaligned head with memcpy so that `dst` is aligned to `align`
+// bytes for the streaming stores. Returns the number of bytes consumed.
+static inline size_t copyAlignHead(char *dst, const char *src, size_t size, size_t align){
+  size_t head = (align - ((uintptr_t)dst & (align - 1))) & (align - 1);
+  if(head > size){
+    head = size;
+  }
+  std::memcpy(dst, src, head);
+  return head;
+}
+
+__attribute__((target("sse2")))
+static void copyRowSSE2(char *dst, const char *src, size_t size){
+  size_t head = copyAlignHead(dst, src, size, 16);
+  dst += head; src += head; size -= head;
+  for(; size >= 64; size -= 64, src += 64, dst += 64){
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE, _MM_HINT_NTA);
+    __m128i a = _mm_loadu_si128((const __m128i*) (src + 0));
+    __m128i b = _mm_loadu_si128((const __m128i*) (src + 16));
+    __m128i c = _mm_loadu_si128((const __m128i*) (src + 32));
+    __m128i d = _mm_loadu_si128((const __m128i*) (src + 48));
+    _mm_stream_si128((__m128i*) (dst + 0), a);
+    _mm_stream_si128((__m128i*) (dst + 16), b);
+    _mm_stream_si128((__m128i*) (dst + 32), c);
+    _mm_stream_si128((__m128i*) (dst + 48), d);
+  }
+  for(; size >= 16; size -= 16, src += 16, dst += 16){
+    _mm_stream_si128((__m128i*) dst, _mm_loadu_si128((const __m128i*) src));
+  }
+  std::memcpy(dst, src, size);
+}
+
+template<bool stream_load>
+__attribute__((target("avx2")))
+static void copyRowAVX2(char *dst, const char *src, size_t size){
+  size_t head = copyAlignHead(dst, src, size, 32);
+  dst += head; src += head; size -= head;
+  // streaming loads need an aligned source, which we get whenever both sides share their alignment
+  if(stream_load && ((uintptr_t)src & 31) == 0){
+    for(; size >= 128; size -= 128, src += 128, dst += 128){
+      __m256i a = _mm256_stream_load_si256((const __m256i*) (src + 0));
+      __m256i b = _mm256_stream_load_si256((const __m256i*) (src + 32));
+      __m256i c = _mm256_stream_load_si256((const __m256i*) (src + 64));
+      __m256i d = _mm256_stream_load_si256((const __m256i*) (src + 96));
+      _mm256_stream_si256((__m256i*) (dst + 0), a);
+      _mm256_stream_si256((__m256i*) (dst + 32), b);
+      _mm256_stream_si256((__m256i*) (dst + 64), c);
+      _mm256_stream_si256((__m256i*) (dst + 96), d);
+    }
+  }
+  for(; size >= 128; size -= 128, src += 128, dst += 128){
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE, _MM_HINT_NTA);
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+    __m256i a = _mm256_loadu_si256((const __m256i*) (src + 0));
+    __m256i b = _mm256_loadu_si256((const __m256i*) (src + 32));
+    __m256i c = _mm256_loadu_si256((const __m256i*) (src + 64));
+    __m256i d = _mm256_loadu_si256((const __m256i*) (src + 96));
+    _mm256_stream_si256((__m256i*) (dst + 0), a);
+    _mm256_stream_si256((__m256i*) (dst + 32), b);
+    _mm256_stream_si256((__m256i*) (dst + 64), c);
+    _mm256_stream_si256((__m256i*) (dst + 96), d);
+  }
+  for(; size >= 32; size -= 32, src += 32, dst += 32){
+    _mm256_stream_si256((__m256i*) dst, _mm256_loadu_si256((const __m256i*) src));
+  }
+  std::memcpy(dst, src, size);
+}
+
+template<bool stream_load>
+__attribute__((target("avx512f")))
+static void copyRowAVX512(char *dst, const char *src, size_t size){
+  size_t head = copyAlignHead(dst, src, size, 64);
+  dst += head; src += head; size -= head;
+  if(stream_load && ((uintptr_t)src & 63) == 0){
+    for(; size >= 256; size -= 256, src += 256, dst += 256){
+      __m512i a = _mm512_stream_load_si512((void*) (src + 0));
+      __m512i b = _mm512_stream_load_si512((void*) (src + 64));
+      __m512i c = _mm512_stream_load_si512((void*) (src + 128));
+      __m512i d = _mm512_stream_load_si512((void*) (src + 192));
+      _mm512_stream_si512((__m512i*) (dst + 0), a);
+      _mm512_stream_si512((__m512i*) (dst + 64), b);
+      _mm512_stream_si512((__m512i*) (dst + 128), c);
+      _mm512_stream_si512((__m512i*) (dst + 192), d);
+    }
+  }
+  for(; size >= 256; size -= 256, src += 256, dst += 256){
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE, _MM_HINT_NTA);
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE + 64, _MM_HINT_NTA);
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE + 128, _MM_HINT_NTA);
+    _mm_prefetch(src + COPY_PREFETCH_DISTANCE + 192, _MM_HINT_NTA);
+    __m512i a = _mm512_loadu_si512((const void*) (src + 0));
+    __m512i b = _mm512_loadu_si512((const void*) (src + 64));
+    __m512i c = _mm512_loadu_si512((const void*) (src + 128));
+    __m512i d = _mm512_loadu_si512((const void*) (src + 192));
+    _mm512_stream_si512((__m512i*) (dst + 0), a);
+    _mm512_stream_si512((__m512i*) (dst + 64), b);
+    _mm512_stream_si512((__m512i*) (dst + 128), c);
+    _mm512_stream_si512((__m512i*) (dst + 192), d);
+  }
+  for(; size >= 64; size -= 64, src += 64, dst += 64){
+    _mm512_stream_si512((__m512i*) dst, _mm512_loadu_si512((const void*) src));
+  }
+  std::memcpy(dst, src, size);
+}
+
+__attribute__((target("avx2")))
+static uint64_t hashAVX2(uint64_t seed, const char *data, size_t size){
+  const size_t total = size;
+  const __m256i keys = _mm256_loadu_si256((const __m256i*) HASH_KEYS);
+  __m256i acc = _mm256_set1_epi64x(seed);
+  for(; size >= 32; size -= 32, data += 32){
+    __m256i word = _mm256_loadu_si256((const __m256i*) data);
+    __m256i keyed = _mm256_xor_si256(word, keys);
+    __m256i product = _mm256_mul_epu32(keyed, _mm256_srli_epi64(keyed, 32));
+    acc = _mm256_or_si256(_mm256_slli_epi64(acc, HASH_ROTATE), _mm256_srli_epi64(acc, 64 - HASH_ROTATE));
+    acc = _mm256_add_epi64(acc, _mm256_add_epi64(word, product));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256((__m256i*) lanes, acc);
+  return hashFinish(lanes, data, size, total);
+}
+
+static bool copySupportsSSE2(){
+  return __builtin_cpu_supports("sse2");
+}
+static bool copySupportsAVX2(){
+  return __builtin_cpu_supports("avx2");
+}
+static bool copySupportsAVX512(){
+  return __builtin_cpu_supports("avx512f");
+}
+#endif
+
+// Ordered by preference, the first supported kernel is the default.
+static const CopyKernel copy_kernels[] = {
+#ifdef PRIMUS_VK_COPY_X86
+  // every CPU with AVX-512 also has AVX2
+  {"avx512", &copyRows<copyRowAVX512<false>, true>, &copyRows<copyRowAVX512<true>, true>, &hashAVX2, &copySupportsAVX512},
+  {"avx2", &copyRows<copyRowAVX2<false>, true>, &copyRows<copyRowAVX2<true>, true>, &hashAVX2, &copySupportsAVX2},
+  // SSE2 has no streaming load, the uncached variant is the same kernel
+  {"sse2", &copyRows<copyRowSSE2, true>, &copyRows<copyRowSSE2, true>, &hashScalar, &copySupportsSSE2},
+#endif
+  {"memcpy", &copyRows<copyRowMemcpy, false>, &copyRows<copyRowMemcpy, false>, &hashScalar, &copyAlwaysSupported},
+};
+
+static const CopyKernel &selectCopyKernel(){
+#ifdef PRIMUS_VK_COPY_X86
+  __builtin_cpu_init();
+#endif
+  const char *forced = getenv("PRIMUS_VK_COPY_KERNEL");
+  if(forced != nullptr){
+    for(const auto &kernel: copy_kernels){
+      if(std::string{forced} == kernel.name){
+	if(kernel.supported()){
+	  return kernel;
+	}
+	std::cerr << "PrimusVK: Copy kernel " << forced << " is not supported by this CPU, ignoring.\n";
+	break;
+      }
+    }
+  }
+  for(const auto &kernel: copy_kernels){
+    if(kernel.supported()){
+      return kernel;
+    }
+  }
+  return copy_kernels[sizeof(copy_kernels) / sizeof(copy_kernels[0]) - 1];
+}
+
+static const CopyKernel &copyKernel(){
+  static const CopyKernel &kernel = selectCopyKernel();
+  return kernel;
+}
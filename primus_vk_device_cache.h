@@ -0,0 +1,205 @@
+// Remembers which physical devices InstanceInfo::searchDevices chose, for the
+// whole process and in $XDG_CACHE_HOME/primus_vk/devices across processes.
+//
+// Physical device handles differ between instances, so the devices are
+// stored by their identity and every instance still has to enumerate them to
+// find their handles. But it skips the search and the queue family queries.
+// Wine, DXVK and launchers create many short lived instances.
+//
+// A selection is stored together with the PRIMUS_VK_DISPLAYID and
+// PRIMUS_VK_RENDERID it was made for, and is only used while both of its
+// devices are still present with the same driver version. Devices are told
+// apart by their device UUID where the driver reports one.
+// PRIMUS_VK_DEVICE_CACHE=0 keeps it (and the other caches of the layer) in
+// memory only.
+
+#include <array>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+struct DeviceIdentity {
+  uint32_t vendorID = 0;
+  uint32_t deviceID = 0;
+  uint32_t driverVersion = 0;
+  uint32_t deviceType = 0;
+  std::array<uint8_t, VK_UUID_SIZE> uuid = {};
+
+  DeviceIdentity() = default;
+  DeviceIdentity(const VkPhysicalDeviceProperties &props):
+    vendorID(props.vendorID), deviceID(props.deviceID), driverVersion(props.driverVersion), deviceType(props.deviceType){
+    memcpy(uuid.data(), props.pipelineCacheUUID, uuid.size());
+  }
+  bool operator==(const DeviceIdentity &other) const {
+    return vendorID == other.vendorID && deviceID == other.deviceID && driverVersion == other.driverVersion
+      && deviceType == other.deviceType && uuid == other.uuid;
+  }
+  bool operator!=(const DeviceIdentity &other) const {
+    return !(*this == other);
+  }
+};
+
+// The identity of `phy`. Its uuid is the device UUID where the device
+// reports one through Vulkan 1.1, so that two identical cards can be told
+// apart, and the pipeline cache UUID otherwise, which such cards share.
+// `dispatch` only has GetPhysicalDeviceProperties2 if the instance enabled
+// Vulkan 1.1 or VK_KHR_get_physical_device_properties2.
+inline DeviceIdentity deviceIdentity(VkPhysicalDevice phy, const VkPhysicalDeviceProperties &props, VkLayerInstanceDispatchTable &dispatch){
+  DeviceIdentity identity{props};
+  if(dispatch.GetPhysicalDeviceProperties2 != nullptr && props.apiVersion >= VK_API_VERSION_1_1){
+    VkPhysicalDeviceIDProperties idProps {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES};
+    VkPhysicalDeviceProperties2 props2 {.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2};
+    props2.pNext = &idProps;
+    dispatch.GetPhysicalDeviceProperties2(phy, &props2);
+    static_assert(VK_UUID_SIZE == sizeof(idProps.deviceUUID), "a device UUID fits the identity");
+    memcpy(identity.uuid.data(), idProps.deviceUUID, identity.uuid.size());
+  }
+  return identity;
+}
+
+inline std::ostream &operator<<(std::ostream &output, const DeviceIdentity &identity){
+  output << std::hex << identity.vendorID << " " << identity.deviceID << " " << identity.driverVersion << " " << identity.deviceType << " ";
+  for(auto byte: identity.uuid){
+    output << std::setw(2) << std::setfill('0') << uint32_t(byte);
+  }
+  return output << std::dec;
+}
+inline std::istream &operator>>(std::istream &input, DeviceIdentity &identity){
+  std::string uuid;
+  input >> std::hex >> identity.vendorID >> identity.deviceID >> identity.driverVersion >> identity.deviceType >> uuid >> std::dec;
+  if(uuid.size() != identity.uuid.size() * 2){
+    input.setstate(std::ios::failbit);
+    return input;
+  }
+  for(size_t i = 0; i < identity.uuid.size(); i++){
+    identity.uuid[i] = strtoul(uuid.substr(i * 2, 2).c_str(), nullptr, 16);
+  }
+  return input;
+}
+
+struct DeviceSelection {
+  // the environment the selection was made with
+  std::string displayID;
+  std::string renderID;
+  DeviceIdentity display;
+  DeviceIdentity render;
+  uint32_t displayQueueFamilyIndex = 0;
+  uint32_t renderQueueFamilyIndex = 0;
+};
+
+// The directory of the layer's caches, created if needed; empty if there is
+// none or the caches are kept in memory.
+inline std::string cacheDirectory(){
+  const char *env = getenv("PRIMUS_VK_DEVICE_CACHE");
+  if(env != nullptr && std::string{env} == "0"){
+    return "";
+  }
+  std::string base;
+  if(const char *cache = getenv("XDG_CACHE_HOME")){
+    base = cache;
+  }else if(const char *home = getenv("HOME")){
+    base = std::string{home} + "/.cache";
+  }else{
+    return "";
+  }
+  mkdir(base.c_str(), 0755);
+  const std::string dir = base + "/primus_vk";
+  mkdir(dir.c_str(), 0755);
+  return dir;
+}
+
+// Replaces `path` with `contents`, through a temporary file that is renamed,
+// so that other processes never read half of it.
+inline void replaceCacheFile(const std::string &path, const std::string &contents){
+  const std::string temporary = path + "." + std::to_string(getpid());
+  {
+    std::ofstream file(temporary);
+    file << contents;
+    if(!file){
+      unlink(temporary.c_str());
+      return;
+    }
+  }
+  rename(temporary.c_str(), path.c_str());
+}
+
+class DeviceSelectionCache {
+  std::mutex lock;
+  bool loaded = false;
+  std::vector<DeviceSelection> selections;
+
+  void load(){
+    loaded = true;
+    const std::string dir = cacheDirectory();
+    if(dir.empty()){
+      return;
+    }
+    std::ifstream file(dir + "/devices");
+    std::string line;
+    while(std::getline(file, line)){
+      std::istringstream fields(line);
+      DeviceSelection selection;
+      fields >> std::quoted(selection.displayID) >> std::quoted(selection.renderID)
+	     >> selection.display >> selection.render
+	     >> selection.displayQueueFamilyIndex >> selection.renderQueueFamilyIndex;
+      if(fields){
+	selections.push_back(selection);
+      }
+    }
+  }
+  void save(){
+    const std::string dir = cacheDirectory();
+    if(dir.empty()){
+      return;
+    }
+    std::ostringstream file;
+    for(const auto &selection: selections){
+      file << std::quoted(selection.displayID) << " " << std::quoted(selection.renderID) << " "
+	   << selection.display << " " << selection.render << " "
+	   << selection.displayQueueFamilyIndex << " " << selection.renderQueueFamilyIndex << "\n";
+    }
+    replaceCacheFile(dir + "/devices", file.str());
+  }
+public:
+  static DeviceSelectionCache &get(){
+    static DeviceSelectionCache cache;
+    return cache;
+  }
+  bool find(const std::string &displayID, const std::string &renderID, DeviceSelection &selection){
+    std::lock_guard<std::mutex> guard(lock);
+    if(!loaded){
+      load();
+    }
+    for(const auto &entry: selections){
+      if(entry.displayID == displayID && entry.renderID == renderID){
+	selection = entry;
+	return true;
+      }
+    }
+    return false;
+  }
+  void store(const DeviceSelection &selection){
+    std::lock_guard<std::mutex> guard(lock);
+    if(!loaded){
+      load();
+    }
+    for(auto &entry: selections){
+      if(entry.displayID == selection.displayID && entry.renderID == selection.renderID){
+	entry = selection;
+	save();
+	return;
+      }
+    }
+    selections.push_back(selection);
+    save();
+  }
+};
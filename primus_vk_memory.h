@@ -0,0 +1,162 @@
+// Sub-allocation of the memory of the layer's images and buffers.
+//
+// A swapchain needs a few images and buffers per swapchain image on both
+// GPUs, and applications recreate their swapchains often, e.g. for every
+// step of a window resize. Drivers limit the number of allocations and are
+// slow to make them, so the memory is taken from large blocks, one set of
+// blocks per memory type.
+//
+// Every allocation is aligned to and padded to bufferImageGranularity, so
+// that linear and optimal resources never share a page, and to
+// nonCoherentAtomSize, so that an allocation can be invalidated on its own.
+// A block of host visible memory is mapped once, when its first allocation
+// is mapped, and stays mapped until the block is freed.
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <stdexcept>
+
+class MemoryArena {
+  // allocations that don't fit are given a block of their own size
+  static constexpr VkDeviceSize BLOCK_SIZE = 64 << 20;
+
+  struct Block {
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize size = 0;
+    uint32_t memory_type = 0;
+    char *mapped = nullptr;
+    size_t allocations = 0;
+    // offset -> size of the free ranges
+    std::map<VkDeviceSize, VkDeviceSize> free;
+  };
+
+  VkDevice device;
+  VkLayerDispatchTable &dispatch;
+  VkDeviceSize granularity;
+  std::mutex lock;
+  // a list, so that allocations can point to their block
+  std::list<Block> blocks;
+
+  static VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment){
+    return (value + alignment - 1) / alignment * alignment;
+  }
+  // Takes `size` bytes at `alignment` from the free ranges of `block`.
+  static bool take(Block &block, VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize &offset){
+    for(auto range = block.free.begin(); range != block.free.end(); range++){
+      const VkDeviceSize start = alignUp(range->first, alignment);
+      const VkDeviceSize end = range->first + range->second;
+      if(start + size > end){
+	continue;
+      }
+      const VkDeviceSize before = range->first;
+      block.free.erase(range);
+      if(start > before){
+	block.free[before] = start - before;
+      }
+      if(start + size < end){
+	block.free[start + size] = end - start - size;
+      }
+      offset = start;
+      return true;
+    }
+    return false;
+  }
+  void release(Block &block){
+    if(block.mapped != nullptr){
+      dispatch.UnmapMemory(device, block.memory);
+    }
+    dispatch.FreeMemory(device, block.memory, nullptr);
+  }
+public:
+  struct Allocation {
+    Block *block = nullptr;
+    VkDeviceMemory memory = VK_NULL_HANDLE;
+    VkDeviceSize offset = 0;
+    VkDeviceSize size = 0;
+  };
+
+  MemoryArena(VkDevice device, VkLayerDispatchTable &dispatch, const VkPhysicalDeviceLimits &limits):
+    device(device), dispatch(dispatch),
+    granularity(std::max<VkDeviceSize>({1, limits.bufferImageGranularity, limits.nonCoherentAtomSize})){
+  }
+  MemoryArena(const MemoryArena &) = delete;
+  ~MemoryArena(){
+    for(auto &block: blocks){
+      release(block);
+    }
+  }
+
+  Allocation allocate(const VkMemoryRequirements &requirements, uint32_t memory_type){
+    const VkDeviceSize alignment = std::max(requirements.alignment, granularity);
+    const VkDeviceSize size = alignUp(requirements.size, granularity);
+    std::lock_guard<std::mutex> guard(lock);
+    Allocation allocation;
+    for(auto &block: blocks){
+      if(block.memory_type == memory_type && take(block, size, alignment, allocation.offset)){
+	allocation.block = &block;
+	break;
+      }
+    }
+    if(allocation.block == nullptr){
+      Block block;
+      block.size = std::max(BLOCK_SIZE, size);
+      block.memory_type = memory_type;
+      VkMemoryAllocateInfo memAllocInfo {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+      memAllocInfo.allocationSize = block.size;
+      memAllocInfo.memoryTypeIndex = memory_type;
+      if(dispatch.AllocateMemory(device, &memAllocInfo, nullptr, &block.memory) != VK_SUCCESS){
+	throw std::runtime_error("Allocating device memory failed.");
+      }
+      block.free[0] = block.size;
+      blocks.push_back(std::move(block));
+      allocation.block = &blocks.back();
+      take(blocks.back(), size, alignment, allocation.offset);
+    }
+    allocation.block->allocations++;
+    allocation.memory = allocation.block->memory;
+    allocation.size = size;
+    return allocation;
+  }
+  void free(const Allocation &allocation){
+    std::lock_guard<std::mutex> guard(lock);
+    Block &block = *allocation.block;
+    auto next = block.free.emplace(allocation.offset, allocation.size).first;
+    // merge with the free ranges around it
+    if(next != block.free.begin()){
+      auto previous = std::prev(next);
+      if(previous->first + previous->second == next->first){
+	previous->second += next->second;
+	block.free.erase(next);
+	next = previous;
+      }
+    }
+    auto after = std::next(next);
+    if(after != block.free.end() && next->first + next->second == after->first){
+      next->second += after->second;
+      block.free.erase(after);
+    }
+    // an empty block is kept while it is the only one of its type, swapchains come and go
+    if(--block.allocations == 0){
+      const bool others = std::any_of(blocks.begin(), blocks.end(), [&block](const Block &other){
+	  return &other != &block && other.memory_type == block.memory_type;
+	});
+      if(others){
+	release(block);
+	blocks.remove_if([&block](const Block &other){ return &other == &block; });
+      }
+    }
+  }
+  // The address of the allocation in the persistent mapping of its block.
+  char *map(const Allocation &allocation){
+    std::lock_guard<std::mutex> guard(lock);
+    Block &block = *allocation.block;
+    if(block.mapped == nullptr){
+      if(dispatch.MapMemory(device, block.memory, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&block.mapped)) != VK_SUCCESS){
+	throw std::runtime_error("Mapping device memory failed.");
+      }
+    }
+    return block.mapped + allocation.offset;
+  }
+};
@@ -0,0 +1,151 @@
+// Picks the memory types the CPU reads frames back from and writes them to,
+// by measuring them.
+//
+// Which host visible memory type is fastest depends on the driver, on
+// whether the whole VRAM is mapped into the CPU's address space (ReBAR) and
+// on whether the GPU is integrated, so a fixed preference list is often
+// wrong. When a device is created, a few MiB are copied out of (on the
+// render GPU) or into (on the display GPU) every eligible memory type with
+// the copy kernel the layer uses for frames, and the fastest type wins.
+//
+// The result is kept per device identity, which includes the driver version,
+// in $XDG_CACHE_HOME/primus_vk/memory_types, so the probe only runs once per
+// device and driver. PRIMUS_VK_MEMORY_PROBE=0 uses the fixed preferences.
+
+#include <chrono>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+enum class MemoryAccess {
+  // the CPU reads frames from the render GPU
+  READBACK,
+  // the CPU writes frames for the display GPU
+  UPLOAD
+};
+
+class MemoryTypeCache {
+  struct Entry {
+    DeviceIdentity device;
+    uint32_t access;
+    int memory_type;
+  };
+  std::mutex lock;
+  bool loaded = false;
+  std::vector<Entry> entries;
+
+  void load(){
+    loaded = true;
+    const std::string dir = cacheDirectory();
+    if(dir.empty()){
+      return;
+    }
+    std::ifstream file(dir + "/memory_types");
+    std::string line;
+    while(std::getline(file, line)){
+      std::istringstream fields(line);
+      Entry entry;
+      fields >> entry.device >> entry.access >> entry.memory_type;
+      if(fields){
+	entries.push_back(entry);
+      }
+    }
+  }
+  void save(){
+    const std::string dir = cacheDirectory();
+    if(dir.empty()){
+      return;
+    }
+    std::ostringstream file;
+    for(const auto &entry: entries){
+      file << entry.device << " " << entry.access << " " << entry.memory_type << "\n";
+    }
+    replaceCacheFile(dir + "/memory_types", file.str());
+  }
+public:
+  static MemoryTypeCache &get(){
+    static MemoryTypeCache cache;
+    return cache;
+  }
+  bool find(const DeviceIdentity &device, MemoryAccess access, int &memory_type){
+    std::lock_guard<std::mutex> guard(lock);
+    if(!loaded){
+      load();
+    }
+    for(const auto &entry: entries){
+      if(entry.device == device && entry.access == uint32_t(access)){
+	memory_type = entry.memory_type;
+	return true;
+      }
+    }
+    return false;
+  }
+  void store(const DeviceIdentity &device, MemoryAccess access, int memory_type){
+    std::lock_guard<std::mutex> guard(lock);
+    if(!loaded){
+      load();
+    }
+    for(auto &entry: entries){
+      if(entry.device == device && entry.access == uint32_t(access)){
+	entry.memory_type = memory_type;
+	save();
+	return;
+      }
+    }
+    entries.push_back(Entry{device, uint32_t(access), memory_type});
+    save();
+  }
+};
+
+// Bytes per second the CPU copies out of (READBACK) or into (UPLOAD) memory
+// of `memory_type`, 0 if it can't be measured.
+inline double probeMemoryType(VkDevice device, VkLayerDispatchTable &dispatch, const VkPhysicalDeviceMemoryProperties &props, uint32_t memory_type, MemoryAccess access){
+  const VkDeviceSize probe_size = 4 << 20;
+  VkBufferCreateInfo bufferCI {.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
+  bufferCI.size = probe_size;
+  bufferCI.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+  bufferCI.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+  VkBuffer buf;
+  if(dispatch.CreateBuffer(device, &bufferCI, nullptr, &buf) != VK_SUCCESS){
+    return 0;
+  }
+  VkMemoryRequirements memRequirements {};
+  dispatch.GetBufferMemoryRequirements(device, buf, &memRequirements);
+  VkDeviceMemory mem = VK_NULL_HANDLE;
+  char *mapped = nullptr;
+  double rate = 0;
+  if((memRequirements.memoryTypeBits & (1u << memory_type)) != 0){
+    VkMemoryAllocateInfo memAllocInfo {.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO};
+    memAllocInfo.allocationSize = memRequirements.size;
+    memAllocInfo.memoryTypeIndex = memory_type;
+    if(dispatch.AllocateMemory(device, &memAllocInfo, nullptr, &mem) == VK_SUCCESS
+       && dispatch.MapMemory(device, mem, 0, VK_WHOLE_SIZE, 0, reinterpret_cast<void**>(&mapped)) == VK_SUCCESS){
+      const bool cached = (props.memoryTypes[memory_type].propertyFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT) != 0;
+      const CopyKernel &kernel = copyKernel();
+      // the same rows the frames are copied in
+      const size_t row_size = 4096, rows = probe_size / row_size;
+      std::vector<char> host(probe_size, 1);
+      // the first round faults the pages in, the best of the others counts
+      for(int round = 0; round < 3; round++){
+	const auto start = std::chrono::steady_clock::now();
+	if(access == MemoryAccess::READBACK){
+	  (cached ? kernel.copy : kernel.copy_uncached)(host.data(), row_size, mapped, row_size, row_size, rows);
+	}else{
+	  kernel.copy(mapped, row_size, host.data(), row_size, row_size, rows);
+	}
+	const double secs = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+	if(round > 0 && secs > 0){
+	  rate = std::max(rate, probe_size / secs);
+	}
+      }
+      dispatch.UnmapMemory(device, mem);
+    }
+    if(mem != VK_NULL_HANDLE){
+      dispatch.FreeMemory(device, mem, nullptr);
+    }
+  }
+  dispatch.DestroyBuffer(device, buf, nullptr);
+  return rate;
+}
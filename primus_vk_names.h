@@ -0,0 +1,95 @@
+// Lookup of intercepted entry points by name, for the GetProcAddr functions.
+//
+// GetProcAddr is called for thousands of names while an application or a
+// translation layer like DXVK starts up, and most of them are not
+// intercepted. So the names are put into a perfect hash table at compile
+// time: a lookup hashes the name once and does at most one string
+// comparison, without allocating or locking.
+//
+// An entry point list is a generic lambda that calls visit(name, function)
+// once per entry. The names are collected at compile time; the functions are
+// collected into a parallel array when the library is loaded, because casting
+// them to PFN_vkVoidFunction is not allowed in a constant expression.
+//
+// Used by both primus_vk.cpp and nv_vulkan_wrapper.cpp.
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+
+template<typename List>
+constexpr size_t countEntries(List list){
+  size_t count = 0;
+  list([&count](const char *, auto){ count++; });
+  return count;
+}
+
+template<typename Function, size_t N, typename List>
+std::array<Function, N> entryFunctions(List list){
+  std::array<Function, N> functions{};
+  size_t i = 0;
+  list([&](const char *, auto function){ functions[i++] = reinterpret_cast<Function>(function); });
+  return functions;
+}
+
+template<size_t N>
+class NameTable {
+  // a power of two with room to spare, so that a collision free seed is found quickly
+  static constexpr size_t slotCount(){
+    size_t slots = 1;
+    while(slots < N * 4){
+      slots *= 2;
+    }
+    return slots;
+  }
+  static constexpr size_t SLOTS = slotCount();
+  static constexpr int16_t EMPTY = -1;
+
+  const char *names[N] = {};
+  uint32_t seed = 0;
+  int16_t slots[SLOTS] = {};
+
+  // FNV-1a
+  static constexpr uint32_t hash(const char *name, uint32_t seed){
+    uint32_t h = 2166136261u ^ seed;
+    for(; *name != '\0'; name++){
+      h = (h ^ uint8_t(*name)) * 16777619u;
+    }
+    return h ^ (h >> 15);
+  }
+  static constexpr bool equal(const char *a, const char *b){
+    for(; *a != '\0' && *a == *b; a++, b++){
+    }
+    return *a == *b;
+  }
+  constexpr bool tryFill(uint32_t seed){
+    for(auto &slot: slots){
+      slot = EMPTY;
+    }
+    for(size_t i = 0; i < N; i++){
+      int16_t &slot = slots[hash(names[i], seed) & (SLOTS - 1)];
+      if(slot != EMPTY){
+	return false;
+      }
+      slot = int16_t(i);
+    }
+    return true;
+  }
+public:
+  template<typename List>
+  constexpr NameTable(List list){
+    size_t i = 0;
+    list([&](const char *name, auto){ names[i++] = name; });
+    while(!tryFill(seed)){
+      seed++;
+    }
+  }
+  // The index of `name` in the list, -1 if it is not in there.
+  int find(const char *name) const {
+    const int16_t index = slots[hash(name, seed) & (SLOTS - 1)];
+    if(index == EMPTY || !equal(names[index], name)){
+      return -1;
+    }
+    return index;
+  }
+};
@@ -0,0 +1,204 @@
+// Persistent work-stealing thread pool that is shared by all swapchains of
+// the process. It is used to split the copy of a single frame into row bands,
+// so that one frame can use more memory bandwidth than a single core provides.
+//
+// The number of threads is taken from PRIMUS_VK_COPY_THREADS. If it is unset
+// (or "auto") it is chosen by measuring how the copy bandwidth scales with
+// the number of threads.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pthread.h>
+
+class WorkPool {
+  struct Job {
+    const std::function<void(size_t)> *fn;
+    std::atomic<size_t> remaining;
+    std::mutex lock;
+    std::condition_variable done;
+  };
+  struct Task {
+    Job *job;
+    size_t index;
+  };
+  struct Worker {
+    std::mutex lock;
+    std::deque<Task> tasks;
+    std::thread thread;
+  };
+
+  std::vector<std::unique_ptr<Worker>> workers;
+  std::mutex sleep_lock;
+  std::condition_variable wake;
+  std::atomic<size_t> pending{0};
+  std::atomic<size_t> next_worker{0};
+  bool active = true;
+
+  static void execute(const Task &task){
+    (*task.job->fn)(task.index);
+    // decrement under the lock, so the job cannot go out of scope before we are done with it
+    std::unique_lock<std::mutex> lock(task.job->lock);
+    if(--task.job->remaining == 0){
+      task.job->done.notify_all();
+    }
+  }
+  // Takes a task from the front of our own queue, or steals from the back of another one.
+  bool take(size_t self, Task &task){
+    for(size_t i = 0; i < workers.size(); i++){
+      Worker &worker = *workers[(self + i) % workers.size()];
+      std::unique_lock<std::mutex> lock(worker.lock);
+      if(worker.tasks.empty()){
+	continue;
+      }
+      if(i == 0){
+	task = worker.tasks.front();
+	worker.tasks.pop_front();
+      }else{
+	task = worker.tasks.back();
+	worker.tasks.pop_back();
+      }
+      pending--;
+      return true;
+    }
+    return false;
+  }
+  void work(size_t self){
+    while(true){
+      Task task;
+      if(take(self, task)){
+	execute(task);
+	continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_lock);
+      wake.wait(lock, [this](){ return !active || pending > 0; });
+      if(!active) return;
+    }
+  }
+
+  static size_t measureThreadCount();
+public:
+  explicit WorkPool(size_t thread_count){
+    // the thread calling run() takes part in the work as well
+    for(size_t i = 1; i < thread_count; i++){
+      workers.emplace_back(new Worker());
+    }
+    for(size_t i = 0; i < workers.size(); i++){
+      workers[i]->thread = std::thread([this, i](){ this->work(i); });
+      pthread_setname_np(workers[i]->thread.native_handle(), "primus-copy");
+    }
+  }
+  WorkPool(const WorkPool &) = delete;
+  ~WorkPool(){
+    {
+      std::unique_lock<std::mutex> lock(sleep_lock);
+      active = false;
+      wake.notify_all();
+    }
+    for(auto &worker: workers){
+      worker->thread.join();
+    }
+  }
+  size_t size() const {
+    return workers.size() + 1;
+  }
+  // Runs fn(0) ... fn(count - 1) on the pool and returns once all of them finished.
+  void run(size_t count, const std::function<void(size_t)> &fn){
+    if(workers.empty() || count <= 1){
+      for(size_t i = 0; i < count; i++){
+	fn(i);
+      }
+      return;
+    }
+    Job job;
+    job.fn = &fn;
+    job.remaining = count;
+    size_t start = next_worker++;
+    for(size_t i = 0; i < count; i++){
+      Worker &worker = *workers[(start + i) % workers.size()];
+      std::unique_lock<std::mutex> lock(worker.lock);
+      worker.tasks.push_back(Task{&job, i});
+      pending++;
+    }
+    {
+      std::unique_lock<std::mutex> lock(sleep_lock);
+      wake.notify_all();
+    }
+    // help out instead of idling, this may also run bands of other frames
+    Task task;
+    while(job.remaining > 0 && take(start % workers.size(), task)){
+      execute(task);
+    }
+    std::unique_lock<std::mutex> lock(job.lock);
+    job.done.wait(lock, [&job](){ return job.remaining == 0; });
+  }
+
+  static WorkPool &get(){
+    static WorkPool pool{threadCount()};
+    return pool;
+  }
+  static size_t threadCount(){
+    const char *env = getenv("PRIMUS_VK_COPY_THREADS");
+    if(env != nullptr && std::string{env} != "auto"){
+      long count = strtol(env, nullptr, 10);
+      if(count >= 1){
+	return count;
+      }
+    }
+    return measureThreadCount();
+  }
+};
+
+// Copies a scratch buffer with an increasing number of threads and picks the
+// smallest count that gets within 10% of the best bandwidth. The probe copies
+// between ordinary host buffers, so it only approximates the readback copy,
+// but it finds the point where more threads stop adding memory bandwidth.
+inline size_t WorkPool::measureThreadCount(){
+  const size_t probe_size = 32 << 20;
+  size_t max_threads = std::thread::hardware_concurrency();
+  if(max_threads > 8){
+    max_threads = 8;
+  }
+  if(max_threads <= 1){
+    return 1;
+  }
+  std::vector<char> src(probe_size, 1);
+  std::vector<char> dst(probe_size, 0);
+  double best_rate = 0;
+  std::vector<std::pair<size_t, double>> rates;
+  for(size_t threads = 1; threads <= max_threads; threads *= 2){
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> copiers;
+    const size_t band = probe_size / threads;
+    for(size_t i = 0; i < threads; i++){
+      copiers.emplace_back([&, i](){
+	std::memcpy(dst.data() + i * band, src.data() + i * band, band);
+      });
+    }
+    for(auto &copier: copiers){
+      copier.join();
+    }
+    double secs = std::chrono::duration_cast<std::chrono::duration<double>>(std::chrono::steady_clock::now() - start).count();
+    double rate = probe_size / secs;
+    rates.emplace_back(threads, rate);
+    if(rate > best_rate){
+      best_rate = rate;
+    }
+  }
+  for(const auto &rate: rates){
+    if(rate.second >= best_rate * 0.9){
+      return rate.first;
+    }
+  }
+  return 1;
+}
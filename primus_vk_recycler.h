@@ -0,0 +1,172 @@
+// Fences, semaphores and command buffers of a device that the layer is done
+// with, to be handed out again instead of creating new ones.
+//
+// Every swapchain needs a few of each per image and chunk, and applications
+// recreate their swapchains often, e.g. for every step of a window resize.
+// So objects are reset when they are taken again rather than destroyed, and
+// are only destroyed together with the device. The counts say how often an
+// object had to be created, was taken again, or had to be destroyed early,
+// so that it can be seen that presenting frames creates and destroys none.
+//
+// A command buffer keeps a command pool of its own, since the swapchain
+// threads record into theirs at the same time.
+
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+struct RecyclerCounts {
+  uint64_t created = 0;
+  uint64_t reused = 0;
+  uint64_t destroyed = 0;
+
+  RecyclerCounts operator+(const RecyclerCounts &other) const {
+    return {created + other.created, reused + other.reused, destroyed + other.destroyed};
+  }
+  RecyclerCounts operator-(const RecyclerCounts &other) const {
+    return {created - other.created, reused - other.reused, destroyed - other.destroyed};
+  }
+};
+
+class ObjectRecycler {
+  VkDevice device;
+  VkLayerDispatchTable &dispatch;
+  std::mutex lock;
+  std::vector<VkFence> fences;
+  std::vector<VkSemaphore> semaphores;
+  // by queue family
+  std::map<uint32_t, std::vector<std::pair<VkCommandPool, VkCommandBuffer>>> command_buffers;
+
+  template<typename Handle>
+  bool take(std::vector<Handle> &handles, Handle &handle){
+    std::lock_guard<std::mutex> guard(lock);
+    if(handles.empty()){
+      return false;
+    }
+    handle = handles.back();
+    handles.pop_back();
+    return true;
+  }
+public:
+  std::atomic<uint64_t> created{0};
+  std::atomic<uint64_t> reused{0};
+  // semaphores that could not be taken back
+  std::atomic<uint64_t> destroyed{0};
+
+  ObjectRecycler(VkDevice device, VkLayerDispatchTable &dispatch): device(device), dispatch(dispatch){
+  }
+  ObjectRecycler(const ObjectRecycler &) = delete;
+  ~ObjectRecycler(){
+    for(auto fence: fences){
+      dispatch.DestroyFence(device, fence, nullptr);
+    }
+    for(auto semaphore: semaphores){
+      dispatch.DestroySemaphore(device, semaphore, nullptr);
+    }
+    for(auto &family: command_buffers){
+      for(auto &buffer: family.second){
+	dispatch.FreeCommandBuffers(device, buffer.first, 1, &buffer.second);
+	dispatch.DestroyCommandPool(device, buffer.first, nullptr);
+      }
+    }
+  }
+
+  // An unsignaled fence.
+  VkFence fence(){
+    VkFence fence;
+    if(take(fences, fence)){
+      reused++;
+      if(dispatch.ResetFences(device, 1, &fence) != VK_SUCCESS){
+	throw std::runtime_error("Resetting a fence failed.");
+      }
+      return fence;
+    }
+    VkFenceCreateInfo fenceInfo = {.sType=VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+    if(dispatch.CreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS){
+      throw std::runtime_error("Creating a fence failed.");
+    }
+    created++;
+    return fence;
+  }
+  // Takes back a fence that no submission uses anymore.
+  void give(VkFence fence){
+    std::lock_guard<std::mutex> guard(lock);
+    fences.push_back(fence);
+  }
+
+  // An unsignaled binary semaphore.
+  VkSemaphore semaphore(){
+    VkSemaphore semaphore;
+    if(take(semaphores, semaphore)){
+      reused++;
+      return semaphore;
+    }
+    VkSemaphoreCreateInfo semInfo = {.sType=VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO};
+    if(dispatch.CreateSemaphore(device, &semInfo, nullptr, &semaphore) != VK_SUCCESS){
+      throw std::runtime_error("Creating a semaphore failed.");
+    }
+    created++;
+    return semaphore;
+  }
+  // Takes back a semaphore that is unsignaled, or whose wait was submitted.
+  // One that may still be signaled can't be reset and has to be destroyed.
+  void give(VkSemaphore semaphore, bool unsignaled){
+    if(!unsignaled){
+      dispatch.DestroySemaphore(device, semaphore, nullptr);
+      destroyed++;
+      return;
+    }
+    std::lock_guard<std::mutex> guard(lock);
+    semaphores.push_back(semaphore);
+  }
+
+  RecyclerCounts counts() const {
+    return {created.load(), reused.load(), destroyed.load()};
+  }
+
+  // A reset primary command buffer of `family` and its pool.
+  std::pair<VkCommandPool, VkCommandBuffer> commandBuffer(uint32_t family){
+    std::pair<VkCommandPool, VkCommandBuffer> buffer;
+    bool found = false;
+    {
+      std::lock_guard<std::mutex> guard(lock);
+      auto &free = command_buffers[family];
+      if(!free.empty()){
+	buffer = free.back();
+	free.pop_back();
+	found = true;
+      }
+    }
+    if(found){
+      reused++;
+      if(dispatch.ResetCommandBuffer(buffer.second, 0) != VK_SUCCESS){
+	throw std::runtime_error("Resetting a command buffer failed.");
+      }
+      return buffer;
+    }
+    VkCommandPoolCreateInfo poolInfo = {.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO};
+    poolInfo.flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+    poolInfo.queueFamilyIndex = family;
+    if(dispatch.CreateCommandPool(device, &poolInfo, nullptr, &buffer.first) != VK_SUCCESS){
+      throw std::runtime_error("Creating a command pool failed.");
+    }
+    VkCommandBufferAllocateInfo cmdBufAllocateInfo = {.sType=VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    cmdBufAllocateInfo.commandPool = buffer.first;
+    cmdBufAllocateInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    cmdBufAllocateInfo.commandBufferCount = 1;
+    if(dispatch.AllocateCommandBuffers(device, &cmdBufAllocateInfo, &buffer.second) != VK_SUCCESS){
+      dispatch.DestroyCommandPool(device, buffer.first, nullptr);
+      throw std::runtime_error("Allocating a command buffer failed.");
+    }
+    created++;
+    return buffer;
+  }
+  // Takes back a command buffer that is not pending anymore.
+  void give(uint32_t family, std::pair<VkCommandPool, VkCommandBuffer> buffer){
+    std::lock_guard<std::mutex> guard(lock);
+    command_buffers[family].push_back(buffer);
+  }
+};
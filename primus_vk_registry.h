@@ -0,0 +1,106 @@
+// Lookup table for the layer's per instance and per device state, keyed by
+// the loader's dispatch pointer (see GetKey).
+//
+// Lookups happen in every intercepted call and on the swapchain threads,
+// while entries are only added and removed when an instance or device is
+// created or destroyed. So readers only do atomic loads on a fixed size open
+// addressing table of pointers to entries, which never move once allocated.
+// Writers serialize on a mutex.
+//
+// A reader that probes past an entry may still look at its key after it was
+// removed, so removed entries only release their value and keep their memory
+// until the registry itself is destroyed. Instances and devices are created
+// rarely enough that this does not add up.
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+template<typename Value, size_t Capacity = 256>
+class DispatchRegistry {
+  struct Entry {
+    void *key;
+    Value value;
+  };
+
+  std::atomic<Entry*> slots[Capacity];
+  std::mutex write_lock;
+  // every entry that was ever inserted
+  std::vector<std::unique_ptr<Entry>> entries;
+
+  // marks a removed entry, lookups have to probe past it
+  static Entry *removed(){
+    static char marker;
+    return reinterpret_cast<Entry*>(&marker);
+  }
+  static size_t home(void *key){
+    // the keys are heap pointers, so the low bits carry little information
+    uint64_t h = reinterpret_cast<uintptr_t>(key);
+    h ^= h >> 17;
+    h *= 0x9e3779b97f4a7c15ull;
+    return (h >> 32) % Capacity;
+  }
+  Entry *find(void *key, size_t *index = nullptr){
+    size_t i = home(key);
+    for(size_t n = 0; n < Capacity; n++, i = (i + 1) % Capacity){
+      Entry *entry = slots[i].load(std::memory_order_acquire);
+      if(entry == nullptr){
+	return nullptr;
+      }
+      if(entry != removed() && entry->key == key){
+	if(index != nullptr){
+	  *index = i;
+	}
+	return entry;
+      }
+    }
+    return nullptr;
+  }
+  Value &insert(void *key){
+    std::lock_guard<std::mutex> lock(write_lock);
+    if(Entry *entry = find(key)){
+      return entry->value;
+    }
+    size_t i = home(key);
+    for(size_t n = 0; n < Capacity; n++, i = (i + 1) % Capacity){
+      Entry *slot = slots[i].load(std::memory_order_relaxed);
+      if(slot == nullptr || slot == removed()){
+	entries.emplace_back(new Entry{key, Value()});
+	slots[i].store(entries.back().get(), std::memory_order_release);
+	return entries.back()->value;
+      }
+    }
+    throw std::runtime_error("Dispatch registry is full.");
+  }
+public:
+  DispatchRegistry(){
+    for(auto &slot: slots){
+      slot.store(nullptr, std::memory_order_relaxed);
+    }
+  }
+  DispatchRegistry(const DispatchRegistry &) = delete;
+
+  // The entry for `key`, nullptr if there is none.
+  Value *get(void *key){
+    Entry *entry = find(key);
+    return entry != nullptr ? &entry->value : nullptr;
+  }
+  // Like std::map, a missing entry is default constructed.
+  Value &operator[](void *key){
+    if(Entry *entry = find(key)){
+      return entry->value;
+    }
+    return insert(key);
+  }
+  void erase(void *key){
+    std::lock_guard<std::mutex> lock(write_lock);
+    size_t index;
+    if(Entry *entry = find(key, &index)){
+      slots[index].store(removed(), std::memory_order_release);
+      entry->value = Value();
+    }
+  }
+};
@@ -0,0 +1,136 @@
+// Bounded single producer, single consumer ring and an event count to sleep
+// on it, for handing frames between the stages of a swapchain.
+//
+// Pushing and popping are a pair of atomic loads and a store, with the slots
+// allocated once when the ring is created. A consumer that finds its ring
+// empty sleeps on a futex of its own, so a producer only wakes the thread it
+// has work for, and only makes a system call if that thread is asleep.
+
+#include <atomic>
+#include <chrono>
+#include <climits>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include <time.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+template<typename T>
+class SpscRing {
+  std::vector<T> slots;
+  size_t mask;
+  // head is only written by the consumer, tail only by the producer
+  alignas(64) std::atomic<size_t> head{0};
+  alignas(64) std::atomic<size_t> tail{0};
+
+  static size_t roundUp(size_t capacity){
+    size_t size = 1;
+    while(size < capacity){
+      size *= 2;
+    }
+    return size;
+  }
+public:
+  explicit SpscRing(size_t capacity): slots(roundUp(capacity)), mask(slots.size() - 1){
+  }
+  SpscRing(const SpscRing &) = delete;
+
+  // False if the ring is full.
+  bool push(T &&value){
+    const size_t t = tail.load(std::memory_order_relaxed);
+    if(t - head.load(std::memory_order_acquire) == slots.size()){
+      return false;
+    }
+    slots[t & mask] = std::move(value);
+    tail.store(t + 1, std::memory_order_release);
+    return true;
+  }
+  // False if the ring is empty.
+  bool pop(T &value){
+    const size_t h = head.load(std::memory_order_relaxed);
+    if(h == tail.load(std::memory_order_acquire)){
+      return false;
+    }
+    value = std::move(slots[h & mask]);
+    head.store(h + 1, std::memory_order_release);
+    return true;
+  }
+};
+
+// A waiter reads the epoch with prepare(), checks its condition once more
+// and then waits for the epoch to change. notify() changes it after the
+// condition was made true, so the wakeup can't be lost in between.
+class EventCount {
+  std::atomic<uint32_t> epoch{0};
+  std::atomic<uint32_t> waiters{0};
+
+  static_assert(sizeof(std::atomic<uint32_t>) == sizeof(uint32_t), "futex needs a plain 32 bit word");
+  uint32_t *word(){
+    return reinterpret_cast<uint32_t*>(&epoch);
+  }
+public:
+  uint32_t prepare(){
+    waiters++;
+    return epoch.load();
+  }
+  void cancel(){
+    waiters--;
+  }
+  void wait(uint32_t prepared){
+    while(epoch.load() == prepared){
+      syscall(SYS_futex, word(), FUTEX_WAIT_PRIVATE, prepared, nullptr, nullptr, 0);
+    }
+    waiters--;
+  }
+  // As wait(), but gives up at `deadline`; false if it did.
+  bool waitUntil(uint32_t prepared, std::chrono::steady_clock::time_point deadline){
+    while(epoch.load() == prepared){
+      const auto now = std::chrono::steady_clock::now();
+      if(now >= deadline){
+	waiters--;
+	return false;
+      }
+      const int64_t left = std::chrono::duration_cast<std::chrono::nanoseconds>(deadline - now).count();
+      const timespec timeout{time_t(left / 1000000000), long(left % 1000000000)};
+      syscall(SYS_futex, word(), FUTEX_WAIT_PRIVATE, prepared, &timeout, nullptr, 0);
+    }
+    waiters--;
+    return true;
+  }
+  void notify(){
+    epoch++;
+    if(waiters.load() != 0){
+      syscall(SYS_futex, word(), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+    }
+  }
+  // Waits until `ready()` is true.
+  template<typename Ready>
+  void await(Ready ready){
+    while(!ready()){
+      const uint32_t prepared = prepare();
+      if(ready()){
+	cancel();
+	return;
+      }
+      wait(prepared);
+    }
+  }
+  // Waits until `ready()` is true or `deadline` passed; whether it became true.
+  template<typename Ready>
+  bool awaitUntil(Ready ready, std::chrono::steady_clock::time_point deadline){
+    while(!ready()){
+      const uint32_t prepared = prepare();
+      if(ready()){
+	cancel();
+	return true;
+      }
+      if(!waitUntil(prepared, deadline)){
+	return ready();
+      }
+    }
+    return true;
+  }
+};